@@ -1,52 +1,20 @@
-#ifdef _WIN32
-#ifndef NOMINMAX
-#define NOMINMAX
-#endif
-#include <windows.h>
-#include <mmsystem.h>
-#pragma comment(lib, "winmm.lib")
-#endif
-
 #include "apu/apu.hpp"
+#include "scheduler/scheduler.hpp"
+#include "state/state.hpp"
 #include <algorithm>
+#include <chrono>
 #include <cmath>
 
-#if !defined(_WIN32) && !defined(JESTER_NO_AUDIO)
-#include <pulse/error.h>
-#include <pulse/simple.h>
-#endif
-
 namespace jester {
 
 // waveform shapes n shit
 constexpr u8 APU::DUTY_TABLE[4][8];
 
-#ifdef _WIN32
-// windows audio shit (double buffered and whatever)
-struct WindowsAudioContext {
-  HWAVEOUT hWaveOut = nullptr;
-  static constexpr int BUFFER_COUNT = 3;
-  WAVEHDR headers[BUFFER_COUNT];
-  std::vector<s16> buffers[BUFFER_COUNT];
-  int currentBuffer = 0;
-  int bufferPos = 0;
-
-  WindowsAudioContext(int bufferSize) {
-    for (int i = 0; i < BUFFER_COUNT; i++) {
-      buffers[i].resize(bufferSize);
-      memset(&headers[i], 0, sizeof(WAVEHDR));
-      headers[i].lpData = (LPSTR)buffers[i].data();
-      headers[i].dwBufferLength = bufferSize * sizeof(s16);
-    }
-  }
-};
-#endif
-
-APU::APU() { sampleBuffer.resize(BUFFER_SIZE); }
+APU::APU() = default;
 
 APU::~APU() { cleanup(); }
 
-bool APU::init() {
+void APU::reset() {
   // waking up the apu state
   ch4.lfsr = 0x7FFF;
   for (int i = 0; i < 16; i++) {
@@ -55,160 +23,280 @@ bool APU::init() {
   nr52 = 0x80;
   nr51 = 0xFF;
   nr50 = 0x77;
+}
 
-#ifdef _WIN32
-  // windows waveout bullshit
-  auto ctx = new WindowsAudioContext(BUFFER_SIZE);
-  audioContext = ctx;
-
-  WAVEFORMATEX wfx = {};
-  wfx.wFormatTag = WAVE_FORMAT_PCM;
-  wfx.nChannels = 1;
-  wfx.nSamplesPerSec = SAMPLE_RATE;
-  wfx.wBitsPerSample = 16;
-  wfx.nBlockAlign = (wfx.nChannels * wfx.wBitsPerSample) / 8;
-  wfx.nAvgBytesPerSec = wfx.nSamplesPerSec * wfx.nBlockAlign;
-
-  MMRESULT result =
-      waveOutOpen(&ctx->hWaveOut, WAVE_MAPPER, &wfx, 0, 0, CALLBACK_NULL);
-  if (result != MMSYSERR_NOERROR) {
-    delete ctx;
-    audioContext = nullptr;
-    return false;
+bool APU::init(const std::string &name) {
+  endFrame(); // whatever was made so far still goes to the old sink
+  cleanup();
+  s16 stale[DEVICE_CHUNK]; // the new one starts from a clean ring
+  while (ring.pop(stale, DEVICE_CHUNK)) {
   }
 
-  // headers will be prepared when first buffer is ready to send
-  running = true;
-  return true;
-
-#else
-// pulse audio for linux nerds
-#ifdef JESTER_NO_AUDIO
-  running = false;
-  return true;
-#else
-  pa_sample_spec spec;
-  spec.format = PA_SAMPLE_S16LE;
-  spec.rate = SAMPLE_RATE;
-  spec.channels = 1;
-
-  pa_buffer_attr bufattr;
-  bufattr.maxlength = BUFFER_SIZE * 4;
-  bufattr.tlength = BUFFER_SIZE * 2;
-  bufattr.prebuf = (u32)-1;
-  bufattr.minreq = (u32)-1;
-  bufattr.fragsize = (u32)-1;
-
-  int error;
-  audioContext =
-      pa_simple_new(nullptr, "jester-gb", PA_STREAM_PLAYBACK, nullptr,
-                    "Game Boy Audio", &spec, nullptr, &bufattr, &error);
-
-  if (!audioContext) {
+  sink = openAudioSink(name, SAMPLE_RATE);
+  synthesize = sink && sink->wantsSamples();
+  blip.clear();
+  blip.setSampleRate(SAMPLE_RATE); // rate control starts over too
+  blipFrameStart = lastSync;
+  lastMix = 0;
+  if (!sink)
     return false;
-  }
 
-  running = true;
+  if (sink->isRealtime()) {
+    running = true;
+    audioThread = std::thread(&APU::audioLoop, this);
+  }
   return true;
-#endif
-#endif
 }
 
 void APU::cleanup() {
   running = false;
+  if (audioThread.joinable())
+    audioThread.join();
+  sink.reset(); // drains the device / finishes the file
+  synthesize = false;
+}
 
-#ifdef _WIN32
-  if (audioContext) {
-    auto ctx = static_cast<WindowsAudioContext *>(audioContext);
-    waveOutReset(ctx->hWaveOut);
-    for (int i = 0; i < WindowsAudioContext::BUFFER_COUNT; i++) {
-      if (ctx->headers[i].dwFlags & WHDR_PREPARED) {
-        waveOutUnprepareHeader(ctx->hWaveOut, &ctx->headers[i], sizeof(WAVEHDR));
-      }
-    }
-    waveOutClose(ctx->hWaveOut);
-    delete ctx;
-    audioContext = nullptr;
+void APU::attachScheduler(Scheduler *sched) {
+  scheduler = sched;
+  if (scheduler) {
+    lastSync = scheduler->now();
+    blipFrameStart = lastSync;
+    scheduler->setHandler(Event::APUFrameSequencer, &APU::onFrameSequencer,
+                          this);
+    scheduler->schedule(Event::APUFrameSequencer,
+                        lastSync + CYCLES_PER_FRAME_SEQUENCER);
   }
-#else
-#ifndef JESTER_NO_AUDIO
-  if (audioContext) {
-    pa_simple_drain(static_cast<pa_simple *>(audioContext), nullptr);
-    pa_simple_free(static_cast<pa_simple *>(audioContext));
-    audioContext = nullptr;
+}
+
+void APU::onFrameSequencer(void *ctx, u64 when) {
+  auto apu = static_cast<APU *>(ctx);
+  apu->catchUp();
+  if (apu->audioEnabled && (apu->nr52 & 0x80)) {
+    apu->stepFrameSequencer();
+    apu->updateOutput(apu->lastSync); // envelopes, length counters
   }
-#endif
-#endif
+  apu->scheduler->schedule(Event::APUFrameSequencer,
+                           when + CYCLES_PER_FRAME_SEQUENCER);
 }
 
-void APU::step(u32 cycles) {
-  if (!audioEnabled || !(nr52 & 0x80)) // audio off? idc bail out
+void APU::catchUp() {
+  // channels only get touched when someone looks at them or the frame
+  // sequencer ticks, not after every single instruction
+  if (!scheduler)
     return;
+  u64 now = scheduler->now();
+  step(now);
+  lastSync = now;
 
-  static u32 cycleAccum = 0;
-  cycleAccum += cycles;
+  // whoever runs us forgot about endFrame, dont let the buffer fill up
+  if (lastSync - blipFrameStart >= BLIP_MAX_CLOCKS / 2)
+    flushSamples();
+}
+
+void APU::endFrame() {
+  catchUp();
+  flushSamples();
+}
 
-  frameSequencerCycles += cycles;
-  while (frameSequencerCycles >= 8192) {
-    frameSequencerCycles -= 8192;
-    stepFrameSequencer();
+static u16 lfsrStep(u16 lfsr, bool narrow) {
+  u8 xorBit = ((lfsr & 1) ^ ((lfsr >> 1) & 1));
+  lfsr = (lfsr >> 1) | (xorBit << 14);
+  if (narrow) {
+    lfsr &= ~(1 << 6);
+    lfsr |= (xorBit << 6);
   }
+  return lfsr;
+}
 
-  static const u32 CYCLES_PER_SAMPLE =
-      CPU_CLOCK_HZ / SAMPLE_RATE; // how many cycles per noise bit
+// every state the noise lfsr goes through, so it can jump n steps ahead
+// with one lookup. 15-bit mode is one big loop over all 32767 nonzero
+// states. in 7-bit mode only the low 7 bits decide where it goes, the top
+// 8 are just the last 8 feedback bits, so after 8 steps its one of 127
+struct LFSRTables {
+  std::array<u16, 32767> seq15;
+  std::array<u16, 32768> index15;
+  std::array<u16, 127> seq7;
+  std::array<u8, 128> index7;
+
+  LFSRTables() {
+    u16 lfsr = 0x7FFF;
+    for (u16 i = 0; i < seq15.size(); i++) {
+      seq15[i] = lfsr;
+      index15[lfsr] = i;
+      lfsr = lfsrStep(lfsr, false);
+    }
+    for (int i = 0; i < 8; i++)
+      lfsr = lfsrStep(lfsr, true);
+    for (u8 i = 0; i < seq7.size(); i++) {
+      seq7[i] = lfsr;
+      index7[lfsr & 0x7F] = i;
+      lfsr = lfsrStep(lfsr, true);
+    }
+  }
+};
 
-  while (cycleAccum >= CYCLES_PER_SAMPLE) {
-    cycleAccum -= CYCLES_PER_SAMPLE;
+static u16 lfsrAdvance(u16 lfsr, bool narrow, u64 steps) {
+  if (steps < 16) {
+    while (steps--)
+      lfsr = lfsrStep(lfsr, narrow);
+    return lfsr;
+  }
+  static const LFSRTables tables;
+  if (narrow) {
+    u8 low = lfsr & 0x7F;
+    return low ? tables.seq7[(tables.index7[low] + steps) % 127] : 0;
+  }
+  return lfsr ? tables.seq15[(tables.index15[lfsr] + steps) % 32767] : 0;
+}
 
-    for (u32 i = 0; i < CYCLES_PER_SAMPLE; i++) {
-      if (ch1.enabled && (i & 3) == 0) {
-        if (ch1.timer > 0)
-          ch1.timer--;
-        if (ch1.timer == 0) {
-          ch1.timer = (2048 - ch1.frequency);
-          ch1.dutyPos = (ch1.dutyPos + 1) & 7;
-        }
-      }
+// run a timer forward, returns how many times it went off. timer is the
+// cycles left to the next edge (0 counts as 1), period what it reloads with
+static u64 advanceTimer(u32 &timer, u32 period, u64 cycles) {
+  u32 left = std::max<u32>(timer, 1);
+  if (cycles < left) {
+    timer = left - static_cast<u32>(cycles);
+    return 0;
+  }
+  u64 over = cycles - left;
+  timer = period - static_cast<u32>(over % period);
+  return over / period + 1;
+}
 
-      if (ch2.enabled && (i & 3) == 0) {
-        if (ch2.timer > 0)
-          ch2.timer--;
-        if (ch2.timer == 0) {
-          ch2.timer = (2048 - ch2.frequency);
-          ch2.dutyPos = (ch2.dutyPos + 1) & 7;
-        }
-      }
+static u32 noisePeriod(u8 polynomial) {
+  u8 divisor = polynomial & 0x07;
+  u8 shift = (polynomial >> 4) & 0x0F;
+  return (divisor == 0 ? 8 : divisor * 16) << shift;
+}
 
-      if (ch3.enabled && (i & 1) == 0) {
-        if (ch3.timer > 0)
-          ch3.timer--;
-        if (ch3.timer == 0) {
-          ch3.timer = (2048 - ch3.frequency);
-          ch3.wavePos = (ch3.wavePos + 1) & 31;
-        }
-      }
+template <typename Square> u64 APU::squareChange(const Square &ch) {
+  if (!ch.enabled || !(ch.envelope & 0xF8) || !ch.volume)
+    return NEVER; // silent (or flat), the level cant move
+  const u8 *pattern = DUTY_TABLE[(ch.duty >> 6) & 0x03];
+  u8 steps = 1; // every pattern has both levels in it, so this ends
+  while (pattern[(ch.dutyPos + steps) & 7] == pattern[ch.dutyPos])
+    steps++;
+  return std::max<u32>(ch.timer, 1) +
+         u64(steps - 1) * ((2048 - ch.frequency) * 4);
+}
 
-      if (ch4.enabled) {
-        if (ch4.timer > 0)
-          ch4.timer--;
-        if (ch4.timer == 0) {
-          u8 divisor = ch4.polynomial & 0x07;
-          u8 shift = (ch4.polynomial >> 4) & 0x0F;
-          ch4.timer = (divisor == 0 ? 8 : divisor * 16) << shift;
-
-          u8 xorBit = ((ch4.lfsr & 1) ^ ((ch4.lfsr >> 1) & 1));
-          ch4.lfsr = (ch4.lfsr >> 1) | (xorBit << 14);
-          if (ch4.polynomial & 0x08) {
-            ch4.lfsr &= ~(1 << 6);
-            ch4.lfsr |= (xorBit << 6);
-          }
-        }
-      }
+template <typename Square> void APU::advanceSquare(Square &ch, u64 n) {
+  u64 edges = advanceTimer(ch.timer, (2048 - ch.frequency) * 4, n);
+  ch.dutyPos = (ch.dutyPos + edges) & 7;
+}
+
+s32 APU::waveLevel(u8 pos) const {
+  u8 sample = ch3.waveRam[pos >> 1];
+  sample = (pos & 1) ? (sample & 0x0F) : (sample >> 4);
+
+  u8 volShift = (ch3.volume >> 5) & 0x03;
+  if (volShift == 0)
+    sample = 0;
+  else
+    sample >>= (volShift - 1);
+  return (s32)sample - 8;
+}
+
+u64 APU::waveChange() const {
+  if (!ch3.enabled || !(ch3.dacEnable & 0x80) || !(ch3.volume & 0x60))
+    return NEVER;
+  s32 level = waveLevel(ch3.wavePos);
+  for (u8 steps = 1; steps < 32; steps++) {
+    if (waveLevel((ch3.wavePos + steps) & 31) != level)
+      return std::max<u32>(ch3.timer, 1) +
+             u64(steps - 1) * ((2048 - ch3.frequency) * 2);
+  }
+  return NEVER; // flat wave
+}
+
+u64 APU::noiseChange() const {
+  if (!ch4.enabled || !(ch4.envelope & 0xF8) || !ch4.volume)
+    return NEVER;
+  bool narrow = ch4.polynomial & 0x08;
+  u16 lfsr = ch4.lfsr;
+  // runs of the same bit are 15 long at most
+  for (u8 steps = 1; steps <= 16; steps++) {
+    lfsr = lfsrStep(lfsr, narrow);
+    if ((lfsr ^ ch4.lfsr) & 1)
+      return std::max<u32>(ch4.timer, 1) +
+             u64(steps - 1) * noisePeriod(ch4.polynomial);
+  }
+  return NEVER; // stuck at 0
+}
+
+u64 APU::nextChange(int channel) const {
+  switch (channel) {
+  case 0:
+    return squareChange(ch1);
+  case 1:
+    return squareChange(ch2);
+  case 2:
+    return waveChange();
+  default:
+    return noiseChange();
+  }
+}
+
+void APU::advanceChannel(int channel, u64 cycles) {
+  switch (channel) {
+  case 0:
+    if (ch1.enabled)
+      advanceSquare(ch1, cycles);
+    break;
+  case 1:
+    if (ch2.enabled)
+      advanceSquare(ch2, cycles);
+    break;
+  case 2:
+    if (ch3.enabled) {
+      u64 edges = advanceTimer(ch3.timer, (2048 - ch3.frequency) * 2, cycles);
+      ch3.wavePos = (ch3.wavePos + edges) & 31;
     }
+    break;
+  default:
+    if (ch4.enabled) {
+      u64 edges = advanceTimer(ch4.timer, noisePeriod(ch4.polynomial), cycles);
+      ch4.lfsr = lfsrAdvance(ch4.lfsr, ch4.polynomial & 0x08, edges);
+    }
+    break;
+  }
+}
+
+// goes straight from one change in output level to the next. whatever the
+// channels do in between (edges that dont change anything, silent
+// channels ticking along) gets skipped over in one go, so the cost is per
+// level change and not per cycle or even per edge. a channel only gets
+// moved when its its turn, nobody elses level changes before then anyway
+void APU::step(u64 until) {
+  // audio off or nobody listening? idc bail out. the frame sequencer still
+  // runs without this, so everything a game can read back stays right
+  if (!synthesize || !audioEnabled || !(nr52 & 0x80))
+    return;
+
+  auto after = [](u64 from, u64 cycles) {
+    return cycles == NEVER ? NEVER : from + cycles;
+  };
+  u64 at[4], next[4]; // cycle each channel is at, when it changes next
+  for (int i = 0; i < 4; i++) {
+    at[i] = lastSync;
+    next[i] = after(lastSync, nextChange(i));
+  }
 
-    s16 sample = mixChannels();
-    outputSample(sample); // spit it out
+  for (;;) {
+    int i = 0;
+    for (int j = 1; j < 4; j++)
+      if (next[j] < next[i])
+        i = j;
+    if (next[i] > until)
+      break;
+
+    advanceChannel(i, next[i] - at[i]);
+    at[i] = next[i];
+    next[i] = after(at[i], nextChange(i));
+    updateOutput(at[i]);
   }
+
+  for (int i = 0; i < 4; i++)
+    advanceChannel(i, until - at[i]);
 }
 
 void APU::stepFrameSequencer() {
@@ -336,7 +424,7 @@ u16 APU::calculateSweepFreq() {
   return newFreq;
 }
 
-s16 APU::mixChannels() {
+s32 APU::mixChannels() {
   s32 output = 0;
   int activeChannels = 0;
 
@@ -355,17 +443,7 @@ s16 APU::mixChannels() {
   }
 
   if (ch3.enabled && (ch3.dacEnable & 0x80)) {
-    u8 pos = ch3.wavePos >> 1;
-    u8 sample = ch3.waveRam[pos];
-    sample = (ch3.wavePos & 1) ? (sample & 0x0F) : (sample >> 4);
-
-    u8 volShift = (ch3.volume >> 5) & 0x03;
-    if (volShift == 0)
-      sample = 0;
-    else
-      sample >>= (volShift - 1);
-
-    output += (s32)sample - 8;
+    output += waveLevel(ch3.wavePos);
     activeChannels++;
   }
 
@@ -378,66 +456,88 @@ s16 APU::mixChannels() {
   if (activeChannels > 0) {
     output = (output * 1500) / activeChannels;
   }
-
-  output = (output * masterVolume) / 100; // master volume multiplier shit
-
-  return static_cast<s16>(std::clamp(output, (s32)-32767, (s32)32767));
+  return output;
 }
 
-void APU::outputSample(s16 sample) {
-#ifdef _WIN32
-  if (!audioContext)
+// the blip buffer only wants to hear about changes
+void APU::updateOutput(u64 cycle) {
+  if (!synthesize || !audioEnabled)
     return;
-  auto ctx = static_cast<WindowsAudioContext *>(audioContext);
-
-  // fill up the buffer
-  ctx->buffers[ctx->currentBuffer][ctx->bufferPos++] = sample;
-
-  if (ctx->bufferPos >= BUFFER_SIZE) {
-    // buffer is full, send it to the speakers
-    WAVEHDR *hdr = &ctx->headers[ctx->currentBuffer];
+  s32 mix = mixChannels();
+  if (mix == lastMix)
+    return;
+  blip.addDelta(static_cast<u32>(cycle - blipFrameStart), mix - lastMix);
+  lastMix = mix;
+}
 
-    // only send if buffer is not still in use (non-blocking)
-    if (!(hdr->dwFlags & WHDR_INQUEUE)) {
-      // unprepare if it was prepared before
-      if (hdr->dwFlags & WHDR_PREPARED) {
-        waveOutUnprepareHeader(ctx->hWaveOut, hdr, sizeof(WAVEHDR));
-      }
+void APU::flushSamples() {
+  if (!synthesize) { // nothing in the buffer, nobody to give it to
+    blipFrameStart = lastSync;
+    return;
+  }
+  blip.endFrame(static_cast<u32>(lastSync - blipFrameStart));
+  blipFrameStart = lastSync;
+  if (running) {
+    // empty ring = run up to 0.5% fast, twice the target or more = 0.5% slow.
+    // only after endFrame: this frame's steps were placed at the old rate,
+    // so its length has to be measured at the old rate too
+    double error = (static_cast<double>(TARGET_FILL) - ring.size()) /
+                   TARGET_FILL;
+    error = std::clamp(error, -1.0, 1.0);
+    blip.setSampleRate(SAMPLE_RATE * (1.0 + MAX_RATE_DELTA * error));
+  }
 
-      // set the data pointer fresh (in case vector reallocated)
-      hdr->lpData = (LPSTR)ctx->buffers[ctx->currentBuffer].data();
-      hdr->dwBufferLength = BUFFER_SIZE * sizeof(s16);
-      waveOutPrepareHeader(ctx->hWaveOut, hdr, sizeof(WAVEHDR));
-      waveOutWrite(ctx->hWaveOut, hdr, sizeof(WAVEHDR));
+  s32 mixed[512];
+  s16 samples[512];
+  while (u32 count = blip.readSamples(mixed, 512)) {
+    for (u32 i = 0; i < count; i++) {
+      s32 sample = mixed[i] * masterVolume / 100; // master volume shit
+      samples[i] = static_cast<s16>(std::clamp(sample, (s32)-32767,
+                                               (s32)32767));
     }
-
-    // move to the next one regardless
-    ctx->bufferPos = 0;
-    ctx->currentBuffer =
-        (ctx->currentBuffer + 1) % WindowsAudioContext::BUFFER_COUNT;
+    if (running) // never blocks, too full = dropped + counted
+      ring.push(samples, count, MAX_FILL);
+    else // files and pipes: every sample, in order, from this thread
+      sink->write(samples, count);
   }
-#else
-#ifndef JESTER_NO_AUDIO
-  if (!audioContext)
-    return;
+}
+
+bool APU::waitForAudio() {
+  if (!running)
+    return false;
+  // a device that stopped taking samples shouldnt freeze the game forever
+  auto giveUp =
+      std::chrono::steady_clock::now() + std::chrono::milliseconds(100);
+  while (running && ring.size() > TARGET_FILL &&
+         std::chrono::steady_clock::now() < giveUp)
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  return true;
+}
 
-  sampleBuffer[sampleIndex++] = sample;
-  if (sampleIndex >= BUFFER_SIZE) {
-    sampleIndex = 0;
-    if (running) {
-      pa_simple_write(static_cast<pa_simple *>(audioContext),
-                      sampleBuffer.data(), BUFFER_SIZE * sizeof(s16), nullptr);
+// the audio thread: ring -> device. device calls are allowed to block
+// here, thats the whole point of having it
+void APU::audioLoop() {
+  bool dry = true; // empty at startup doesnt count as an underrun
+  s16 chunk[DEVICE_CHUNK];
+  while (running) {
+    u32 count = ring.pop(chunk, DEVICE_CHUNK);
+    if (!count) {
+      if (!dry)
+        ring.noteUnderrun();
+      dry = true;
+      std::this_thread::sleep_for(std::chrono::milliseconds(2));
+      continue;
     }
+    dry = false;
+    sink->write(chunk, count);
   }
-#endif
-#endif
 }
 
 void APU::triggerChannel1() {
   ch1.enabled = true;
   if (ch1.lengthCounter == 0)
     ch1.lengthCounter = 64;
-  ch1.timer = (2048 - ch1.frequency);
+  ch1.timer = (2048 - ch1.frequency) * 4;
   ch1.envelopeTimer = ch1.envelope & 0x07;
   ch1.volume = (ch1.envelope >> 4) & 0x0F;
   ch1.shadowFreq = ch1.frequency;
@@ -455,7 +555,7 @@ void APU::triggerChannel2() {
   ch2.enabled = true;
   if (ch2.lengthCounter == 0)
     ch2.lengthCounter = 64;
-  ch2.timer = (2048 - ch2.frequency);
+  ch2.timer = (2048 - ch2.frequency) * 4;
   ch2.envelopeTimer = ch2.envelope & 0x07;
   ch2.volume = (ch2.envelope >> 4) & 0x0F;
   if (!(ch2.envelope & 0xF8))
@@ -466,7 +566,7 @@ void APU::triggerChannel3() {
   ch3.enabled = true;
   if (ch3.lengthCounter == 0)
     ch3.lengthCounter = 256;
-  ch3.timer = (2048 - ch3.frequency);
+  ch3.timer = (2048 - ch3.frequency) * 2;
   ch3.wavePos = 0;
   if (!(ch3.dacEnable & 0x80))
     ch3.enabled = false;
@@ -483,7 +583,9 @@ void APU::triggerChannel4() {
     ch4.enabled = false;
 }
 
-u8 APU::readRegister(u16 addr) const {
+u8 APU::readRegister(u16 addr) {
+  catchUp();
+
   switch (addr) {
   case 0xFF10:
     return ch1.sweep | 0x80;
@@ -536,6 +638,8 @@ u8 APU::readRegister(u16 addr) const {
 }
 
 void APU::writeRegister(u16 addr, u8 val) {
+  catchUp();
+
   if (!(nr52 & 0x80)) {
     if (addr == 0xFF26) {
       nr52 = val & 0x80;
@@ -646,6 +750,135 @@ void APU::writeRegister(u16 addr, u8 val) {
     }
     break;
   }
+
+  updateOutput(lastSync); // volume, trigger, dac, whatever just changed
+}
+
+// channel state only, the output device and master volume arent part of
+// the machine
+void APU::serialize(Writer &w) const {
+  w.write64(lastSync);
+  w.write8(frameSequencerStep);
+
+  w.write8(ch1.sweep);
+  w.write8(ch1.duty);
+  w.write8(ch1.envelope);
+  w.write8(ch1.freqLo);
+  w.write8(ch1.freqHi);
+  w.writeBool(ch1.enabled);
+  w.write16(ch1.frequency);
+  w.write32(ch1.timer);
+  w.write8(ch1.dutyPos);
+  w.write8(ch1.volume);
+  w.write8(ch1.envelopeTimer);
+  w.write16(ch1.sweepTimer);
+  w.write16(ch1.shadowFreq);
+  w.write16(ch1.lengthCounter);
+  w.writeBool(ch1.sweepEnabled);
+
+  w.write8(ch2.duty);
+  w.write8(ch2.envelope);
+  w.write8(ch2.freqLo);
+  w.write8(ch2.freqHi);
+  w.writeBool(ch2.enabled);
+  w.write16(ch2.frequency);
+  w.write32(ch2.timer);
+  w.write8(ch2.dutyPos);
+  w.write8(ch2.volume);
+  w.write8(ch2.envelopeTimer);
+  w.write16(ch2.lengthCounter);
+
+  w.write8(ch3.dacEnable);
+  w.write8(ch3.length);
+  w.write8(ch3.volume);
+  w.write8(ch3.freqLo);
+  w.write8(ch3.freqHi);
+  w.writeBool(ch3.enabled);
+  w.write16(ch3.frequency);
+  w.write32(ch3.timer);
+  w.write8(ch3.wavePos);
+  w.write16(ch3.lengthCounter);
+  w.writeBytes(ch3.waveRam.data(), ch3.waveRam.size());
+
+  w.write8(ch4.length);
+  w.write8(ch4.envelope);
+  w.write8(ch4.polynomial);
+  w.write8(ch4.control);
+  w.writeBool(ch4.enabled);
+  w.write32(ch4.timer);
+  w.write8(ch4.volume);
+  w.write8(ch4.envelopeTimer);
+  w.write16(ch4.lfsr);
+  w.write16(ch4.lengthCounter);
+
+  w.write8(nr50);
+  w.write8(nr51);
+  w.write8(nr52);
+}
+
+void APU::deserialize(Reader &r) {
+  lastSync = r.read64();
+  frameSequencerStep = r.read8();
+
+  ch1.sweep = r.read8();
+  ch1.duty = r.read8();
+  ch1.envelope = r.read8();
+  ch1.freqLo = r.read8();
+  ch1.freqHi = r.read8();
+  ch1.enabled = r.readBool();
+  ch1.frequency = r.read16();
+  ch1.timer = r.read32();
+  ch1.dutyPos = r.read8();
+  ch1.volume = r.read8();
+  ch1.envelopeTimer = r.read8();
+  ch1.sweepTimer = r.read16();
+  ch1.shadowFreq = r.read16();
+  ch1.lengthCounter = r.read16();
+  ch1.sweepEnabled = r.readBool();
+
+  ch2.duty = r.read8();
+  ch2.envelope = r.read8();
+  ch2.freqLo = r.read8();
+  ch2.freqHi = r.read8();
+  ch2.enabled = r.readBool();
+  ch2.frequency = r.read16();
+  ch2.timer = r.read32();
+  ch2.dutyPos = r.read8();
+  ch2.volume = r.read8();
+  ch2.envelopeTimer = r.read8();
+  ch2.lengthCounter = r.read16();
+
+  ch3.dacEnable = r.read8();
+  ch3.length = r.read8();
+  ch3.volume = r.read8();
+  ch3.freqLo = r.read8();
+  ch3.freqHi = r.read8();
+  ch3.enabled = r.readBool();
+  ch3.frequency = r.read16();
+  ch3.timer = r.read32();
+  ch3.wavePos = r.read8();
+  ch3.lengthCounter = r.read16();
+  r.readBytes(ch3.waveRam.data(), ch3.waveRam.size());
+
+  ch4.length = r.read8();
+  ch4.envelope = r.read8();
+  ch4.polynomial = r.read8();
+  ch4.control = r.read8();
+  ch4.enabled = r.readBool();
+  ch4.timer = r.read32();
+  ch4.volume = r.read8();
+  ch4.envelopeTimer = r.read8();
+  ch4.lfsr = r.read16();
+  ch4.lengthCounter = r.read16();
+
+  nr50 = r.read8();
+  nr51 = r.read8();
+  nr52 = r.read8();
+
+  // whatever was queued belongs to the timeline we just left
+  blip.clear();
+  lastMix = 0;
+  blipFrameStart = lastSync;
 }
 
 } // namespace jester
@@ -1,41 +1,92 @@
 #pragma once
 
+#include "apu/audio_ring.hpp"
+#include "apu/audio_sink.hpp"
+#include "apu/blip_buffer.hpp"
 #include "types.hpp"
 #include <array>
 #include <atomic>
-#include <vector>
+#include <memory>
+#include <string>
+#include <thread>
 
 namespace jester {
 
+class Reader;
+class Scheduler;
+class Writer;
+
 class APU {
 public:
   APU();
   ~APU();
 
-  bool init();
+  // open an output (see openAudioSink, "" = the sound card). until then,
+  // or if it wont open, its the null sink: no sound and no synthesis.
+  // only swaps where the samples go, fine to call mid game
+  bool init(const std::string &sink = "");
+  void reset(); // post-boot register state, leaves the output alone
   void cleanup();
-  void step(u32 cycles);
+  void attachScheduler(Scheduler *sched);
+  void catchUp(); // run the channels up to the scheduler's current cycle
+  // turn everything up to now into samples and send them off. once per
+  // frame is plenty, the buffer holds a few frames worth
+  void endFrame();
 
-  u8 readRegister(u16 addr) const;
+  u8 readRegister(u16 addr);
   void writeRegister(u16 addr, u8 val);
 
   void setEnabled(bool enabled) { audioEnabled = enabled; }
   bool isEnabled() const { return audioEnabled; }
   void setVolume(int vol) { masterVolume = vol; }
+  // fill level and under/overrun counts of the way to the audio thread
+  const AudioRing &getAudioRing() const { return ring; }
+  bool hasAudioDevice() const { return running; }
+  // audio as the master clock: sleep until the device has played the ring
+  // back down to its target fill. false (right away) without a device
+  bool waitForAudio();
+
+  // save states (see state/state.hpp)
+  void serialize(Writer &w) const;
+  void deserialize(Reader &r);
 
 private:
-  void *audioContext = nullptr; // audio handle (pulse or windows shit)
-  std::atomic<bool> running{false};
+  std::unique_ptr<AudioSink> sink;
+  bool synthesize = false;           // theres a sink that wants samples
+  std::atomic<bool> running{false};  // audio thread feeding a realtime sink
   std::atomic<bool> audioEnabled{true};
 
   static constexpr int SAMPLE_RATE = 44100;
-  static constexpr int BUFFER_SIZE = 1024;
-  std::vector<s16> sampleBuffer;
-  int sampleIndex = 0;
 
-  u32 frameSequencerCycles = 0;
+  // dynamic rate control: the output rate gets nudged by up to 0.5% so the
+  // ring hovers around TARGET_FILL (measured right before a frame goes in)
+  // instead of slowly running dry or piling up latency. 0.5% is way under
+  // what anyone can hear as pitch
+  static constexpr u32 TARGET_FILL = 384; // ~9ms
+  // past this (a stall, the device hiccuping) rate control would take ages
+  // to work it off, so new samples just get dropped until its back down
+  static constexpr u32 MAX_FILL = TARGET_FILL * 4;
+  static constexpr double MAX_RATE_DELTA = 0.005;
+  static constexpr u32 DEVICE_CHUNK = 256; // samples per device write
+
+  // emulation pushes, the audio thread feeds the device at its own pace,
+  // so a slow or full device never holds up emulation (realtime sinks only)
+  AudioRing ring;
+  std::thread audioThread;
+  void audioLoop();
+
+  Scheduler *scheduler = nullptr;
+  u64 lastSync = 0;    // cycle the channels were last brought up to
   u8 frameSequencerStep = 0;
 
+  // channel output changes go in here as steps, endFrame reads samples out
+  static constexpr u32 BLIP_MAX_CLOCKS = CYCLES_PER_FRAME * 4;
+  BlipBuffer blip{CPU_CLOCK_HZ, SAMPLE_RATE, BLIP_MAX_CLOCKS};
+  u64 blipFrameStart = 0; // cycle blip time 0 stands for
+  s32 lastMix = 0;        // level the blip buffer is sitting at
+
+  static constexpr u32 CYCLES_PER_FRAME_SEQUENCER = 8192;
+
   struct Channel1 {
     u8 sweep = 0, duty = 0, envelope = 0, freqLo = 0, freqHi = 0;
     bool enabled = false;
@@ -81,12 +132,26 @@ private:
                                           {1, 0, 0, 0, 0, 1, 1, 1},
                                           {0, 1, 1, 1, 1, 1, 1, 0}};
 
+  static void onFrameSequencer(void *ctx, u64 when);
+  void step(u64 until);
+  // closed form channel timing: how many cycles until a channel's output
+  // level changes next (NEVER if it cant), and moving channels ahead by any
+  // number of cycles without visiting the edges in between
+  static constexpr u64 NEVER = ~u64(0);
+  template <typename Square> static u64 squareChange(const Square &ch);
+  template <typename Square> static void advanceSquare(Square &ch, u64 n);
+  u64 waveChange() const;
+  u64 noiseChange() const;
+  u64 nextChange(int channel) const; // 0-3 = ch1-ch4
+  void advanceChannel(int channel, u64 cycles);
+  s32 waveLevel(u8 pos) const;
   void stepFrameSequencer();
   void stepLength();
   void stepEnvelope();
   void stepSweep();
-  s16 mixChannels();
-  void outputSample(s16 sample);
+  s32 mixChannels();
+  void updateOutput(u64 cycle);
+  void flushSamples();
   void triggerChannel1();
   void triggerChannel2();
   void triggerChannel3();
@@ -0,0 +1,68 @@
+#pragma once
+
+#include "types.hpp"
+#include <algorithm>
+#include <array>
+#include <atomic>
+
+namespace jester {
+
+// samples from the emulation thread to the audio thread. one writer, one
+// reader, no locks: each side owns one index and only reads the other's.
+// indices just count up forever, masking picks the slot. neither side ever
+// waits, a full ring drops the new samples (overrun) and an empty one
+// leaves the reader with nothing (underrun), both get counted
+class AudioRing {
+public:
+  static constexpr u32 CAPACITY = 8192; // ~186ms at 44.1khz, power of 2
+
+  // writer side, returns how many fit. limit caps the fill below the
+  // capacity, whatever goes over counts as dropped too
+  u32 push(const s16 *samples, u32 count, u32 limit = CAPACITY) {
+    u64 w = writePos.load(std::memory_order_relaxed);
+    u64 r = readPos.load(std::memory_order_acquire);
+    u32 fill = static_cast<u32>(w - r);
+    u32 n = fill < limit ? std::min(count, limit - fill) : 0;
+    if (n < count)
+      overruns.fetch_add(count - n, std::memory_order_relaxed);
+    for (u32 i = 0; i < n; i++)
+      ring[(w + i) & MASK] = samples[i];
+    writePos.store(w + n, std::memory_order_release);
+    return n;
+  }
+
+  // reader side, returns how many it got
+  u32 pop(s16 *out, u32 max) {
+    u64 r = readPos.load(std::memory_order_relaxed);
+    u64 w = writePos.load(std::memory_order_acquire);
+    u32 n = std::min(max, static_cast<u32>(w - r));
+    for (u32 i = 0; i < n; i++)
+      out[i] = ring[(r + i) & MASK];
+    readPos.store(r + n, std::memory_order_release);
+    return n;
+  }
+  void noteUnderrun() { underruns.fetch_add(1, std::memory_order_relaxed); }
+
+  // either side, or anyone else who wants numbers
+  u32 size() const {
+    // reader first, so the writer can only make the gap look bigger
+    u64 r = readPos.load(std::memory_order_acquire);
+    u64 w = writePos.load(std::memory_order_acquire);
+    return static_cast<u32>(std::min<u64>(w - r, CAPACITY));
+  }
+  u64 getUnderruns() const { return underruns.load(); } // times it ran dry
+  u64 getOverruns() const { return overruns.load(); }   // samples dropped
+
+private:
+  static constexpr u32 MASK = CAPACITY - 1;
+  static_assert((CAPACITY & MASK) == 0, "capacity has to be a power of 2");
+
+  std::array<s16, CAPACITY> ring{};
+  // own cache lines, or both threads keep stealing the line from each other
+  alignas(64) std::atomic<u64> writePos{0};
+  alignas(64) std::atomic<u64> readPos{0};
+  alignas(64) std::atomic<u64> overruns{0};
+  std::atomic<u64> underruns{0};
+};
+
+} // namespace jester
@@ -0,0 +1,342 @@
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#include <io.h>
+#include <mmsystem.h>
+#pragma comment(lib, "winmm.lib")
+#else
+#include <cerrno>
+#include <csignal>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
+#include "apu/audio_sink.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#if !defined(_WIN32) && !defined(JESTER_NO_AUDIO)
+#include <pulse/error.h>
+#include <pulse/simple.h>
+#endif
+
+namespace jester {
+
+namespace {
+
+constexpr u32 BUFFER_SIZE = 1024; // samples, sound card buffers
+
+// files and pipes get little endian no matter what the host is
+void toLittleEndian(const s16 *samples, u32 count, std::vector<u8> &out) {
+  out.resize(count * 2);
+  for (u32 i = 0; i < count; i++) {
+    u16 v = static_cast<u16>(samples[i]);
+    out[i * 2] = v & 0xFF;
+    out[i * 2 + 1] = v >> 8;
+  }
+}
+
+void putLE32(u8 *out, u32 v) {
+  for (int i = 0; i < 4; i++)
+    out[i] = (v >> (i * 8)) & 0xFF;
+}
+
+class NullSink : public AudioSink {
+public:
+  bool isRealtime() const override { return false; }
+  bool wantsSamples() const override { return false; }
+  void write(const s16 *, u32) override {}
+};
+
+#ifdef _WIN32
+// windows waveout bullshit. a few buffers in flight, write() fills the
+// current one and queues it once its full
+class WinMMSink : public AudioSink {
+public:
+  static std::unique_ptr<AudioSink> open(u32 sampleRate) {
+    std::unique_ptr<WinMMSink> sink(new WinMMSink());
+    WAVEFORMATEX wfx = {};
+    wfx.wFormatTag = WAVE_FORMAT_PCM;
+    wfx.nChannels = 1;
+    wfx.nSamplesPerSec = sampleRate;
+    wfx.wBitsPerSample = 16;
+    wfx.nBlockAlign = (wfx.nChannels * wfx.wBitsPerSample) / 8;
+    wfx.nAvgBytesPerSec = wfx.nSamplesPerSec * wfx.nBlockAlign;
+    if (waveOutOpen(&sink->hWaveOut, WAVE_MAPPER, &wfx, 0, 0,
+                    CALLBACK_NULL) != MMSYSERR_NOERROR)
+      return nullptr;
+    return sink;
+  }
+
+  ~WinMMSink() override {
+    if (!hWaveOut)
+      return;
+    waveOutReset(hWaveOut);
+    for (int i = 0; i < BUFFER_COUNT; i++) {
+      if (headers[i].dwFlags & WHDR_PREPARED)
+        waveOutUnprepareHeader(hWaveOut, &headers[i], sizeof(WAVEHDR));
+    }
+    waveOutClose(hWaveOut);
+  }
+
+  bool isRealtime() const override { return true; }
+
+  void write(const s16 *samples, u32 count) override {
+    while (count) {
+      WAVEHDR *hdr = &headers[current];
+      while (hdr->dwFlags & WHDR_INQUEUE) // device still playing this one
+        Sleep(1);
+      u32 n = std::min(count, BUFFER_SIZE - fill);
+      std::memcpy(buffers[current].data() + fill, samples, n * sizeof(s16));
+      fill += n;
+      samples += n;
+      count -= n;
+      if (fill < BUFFER_SIZE)
+        break;
+
+      // unprepare if it was prepared before
+      if (hdr->dwFlags & WHDR_PREPARED)
+        waveOutUnprepareHeader(hWaveOut, hdr, sizeof(WAVEHDR));
+      waveOutPrepareHeader(hWaveOut, hdr, sizeof(WAVEHDR));
+      waveOutWrite(hWaveOut, hdr, sizeof(WAVEHDR));
+      current = (current + 1) % BUFFER_COUNT;
+      fill = 0;
+    }
+  }
+
+private:
+  static constexpr int BUFFER_COUNT = 3;
+
+  WinMMSink() {
+    for (int i = 0; i < BUFFER_COUNT; i++) {
+      buffers[i].resize(BUFFER_SIZE);
+      std::memset(&headers[i], 0, sizeof(WAVEHDR));
+      headers[i].lpData = (LPSTR)buffers[i].data();
+      headers[i].dwBufferLength = BUFFER_SIZE * sizeof(s16);
+    }
+  }
+
+  HWAVEOUT hWaveOut = nullptr;
+  WAVEHDR headers[BUFFER_COUNT];
+  std::vector<s16> buffers[BUFFER_COUNT];
+  int current = 0;
+  u32 fill = 0; // samples already in the current buffer
+};
+#elif !defined(JESTER_NO_AUDIO)
+// pulse audio for linux nerds
+class PulseSink : public AudioSink {
+public:
+  static std::unique_ptr<AudioSink> open(u32 sampleRate) {
+    pa_sample_spec spec;
+    spec.format = PA_SAMPLE_S16LE;
+    spec.rate = sampleRate;
+    spec.channels = 1;
+
+    pa_buffer_attr bufattr;
+    // in bytes. tlength is the latency pulse adds on top of the ring,
+    // 768 samples = ~17ms
+    bufattr.maxlength = BUFFER_SIZE * 4;
+    bufattr.tlength = BUFFER_SIZE * 3 / 2;
+    bufattr.prebuf = (u32)-1;
+    bufattr.minreq = (u32)-1;
+    bufattr.fragsize = (u32)-1;
+
+    int error;
+    pa_simple *pa =
+        pa_simple_new(nullptr, "jester-gb", PA_STREAM_PLAYBACK, nullptr,
+                      "Game Boy Audio", &spec, nullptr, &bufattr, &error);
+    if (!pa)
+      return nullptr;
+    return std::unique_ptr<AudioSink>(new PulseSink(pa));
+  }
+
+  ~PulseSink() override {
+    pa_simple_drain(pa, nullptr);
+    pa_simple_free(pa);
+  }
+
+  bool isRealtime() const override { return true; }
+
+  void write(const s16 *samples, u32 count) override {
+    pa_simple_write(pa, samples, count * sizeof(s16), nullptr);
+  }
+
+private:
+  explicit PulseSink(pa_simple *pa) : pa(pa) {}
+  pa_simple *pa;
+};
+#endif
+
+// plain 16-bit mono pcm .wav. the sizes in the header get filled in when
+// the sink goes away, until then they say 0
+class WavSink : public AudioSink {
+public:
+  static std::unique_ptr<AudioSink> open(const std::string &path,
+                                         u32 sampleRate) {
+    FILE *file = std::fopen(path.c_str(), "wb");
+    if (!file)
+      return nullptr;
+
+    u8 header[44] = {'R', 'I', 'F', 'F', 0, 0, 0, 0, 'W', 'A', 'V', 'E',
+                     'f', 'm', 't', ' ', 16, 0, 0, 0, 1, 0, 1, 0};
+    putLE32(header + 24, sampleRate);
+    putLE32(header + 28, sampleRate * 2); // bytes per second
+    header[32] = 2;                       // bytes per sample frame
+    header[34] = 16;                      // bits per sample
+    std::memcpy(header + 36, "data", 4);
+    if (std::fwrite(header, 1, sizeof(header), file) != sizeof(header)) {
+      std::fclose(file);
+      return nullptr;
+    }
+    return std::unique_ptr<AudioSink>(new WavSink(file));
+  }
+
+  ~WavSink() override {
+    u8 size[4];
+    putLE32(size, 36 + dataBytes);
+    std::fseek(file, 4, SEEK_SET);
+    std::fwrite(size, 1, 4, file);
+    putLE32(size, dataBytes);
+    std::fseek(file, 40, SEEK_SET);
+    std::fwrite(size, 1, 4, file);
+    std::fclose(file);
+  }
+
+  bool isRealtime() const override { return false; }
+
+  void write(const s16 *samples, u32 count) override {
+    toLittleEndian(samples, count, bytes);
+    dataBytes += static_cast<u32>(std::fwrite(bytes.data(), 1, bytes.size(),
+                                              file));
+  }
+
+private:
+  explicit WavSink(FILE *file) : file(file) {}
+  FILE *file;
+  u32 dataBytes = 0;
+  std::vector<u8> bytes;
+};
+
+// raw s16le, no header, into an fd someone else opened. blocks when the
+// reader is slow (nonblocking fds get polled), gives up for good once the
+// reader is gone. a closed pipe must not kill the process with SIGPIPE,
+// but the signal setup belongs to whoever embeds us, so its only held
+// off for this thread while writing
+class FdSink : public AudioSink {
+public:
+  static std::unique_ptr<AudioSink> open(int fd) {
+#ifndef _WIN32
+    if (fcntl(fd, F_GETFD) == -1)
+      return nullptr;
+#ifdef F_SETNOSIGPIPE
+    fcntl(fd, F_SETNOSIGPIPE, 1); // macos: per fd, nothing else needed
+#endif
+#endif
+    return std::unique_ptr<AudioSink>(new FdSink(fd));
+  }
+
+  bool isRealtime() const override { return false; }
+
+  void write(const s16 *samples, u32 count) override {
+    if (fd < 0)
+      return;
+    toLittleEndian(samples, count, bytes);
+#ifdef _WIN32
+    const u8 *data = bytes.data();
+    size_t left = bytes.size();
+    while (left) {
+      int n = _write(fd, data, static_cast<unsigned>(left));
+      if (n <= 0) {
+        fd = -1;
+        return;
+      }
+      data += n;
+      left -= n;
+    }
+#elif defined(F_SETNOSIGPIPE)
+    if (!send(bytes.data(), bytes.size()))
+      fd = -1;
+#else
+    sigset_t pipe, old, pending;
+    sigemptyset(&pipe);
+    sigaddset(&pipe, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &pipe, &old);
+    sigpending(&pending);
+    bool wasPending = sigismember(&pending, SIGPIPE);
+
+    if (!send(bytes.data(), bytes.size())) {
+      fd = -1;
+      // eat the SIGPIPE that write just raised, unless one was already
+      // waiting before (thats someone else's)
+      timespec zero = {0, 0};
+      if (!wasPending)
+        sigtimedwait(&pipe, nullptr, &zero);
+    }
+    pthread_sigmask(SIG_SETMASK, &old, nullptr);
+#endif
+  }
+
+private:
+  explicit FdSink(int fd) : fd(fd) {}
+
+#ifndef _WIN32
+  // false once the reader is gone (or the fd broke some other way)
+  bool send(const u8 *data, size_t left) {
+    while (left) {
+      ssize_t n = ::write(fd, data, left);
+      if (n < 0) {
+        if (errno == EINTR)
+          continue;
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+          pollfd out = {fd, POLLOUT, 0};
+          poll(&out, 1, 100);
+          continue;
+        }
+        return false;
+      }
+      data += n;
+      left -= n;
+    }
+    return true;
+  }
+#endif
+
+  int fd;
+  std::vector<u8> bytes;
+};
+
+} // namespace
+
+std::unique_ptr<AudioSink> openAudioSink(const std::string &spec,
+                                         u32 sampleRate) {
+  if (spec.empty() || spec == "default") {
+#ifdef _WIN32
+    return WinMMSink::open(sampleRate);
+#elif !defined(JESTER_NO_AUDIO)
+    return PulseSink::open(sampleRate);
+#else
+    return nullptr; // built without a sound card backend
+#endif
+  }
+  if (spec == "null")
+    return std::unique_ptr<AudioSink>(new NullSink());
+  if (spec.compare(0, 4, "wav:") == 0 && spec.size() > 4)
+    return WavSink::open(spec.substr(4), sampleRate);
+  if (spec.compare(0, 3, "fd:") == 0 && spec.size() > 3) {
+    char *end;
+    long fd = std::strtol(spec.c_str() + 3, &end, 10);
+    if (*end || fd < 0)
+      return nullptr;
+    return FdSink::open(static_cast<int>(fd));
+  }
+  return nullptr;
+}
+
+} // namespace jester
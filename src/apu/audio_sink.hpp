@@ -0,0 +1,37 @@
+#pragma once
+
+#include "types.hpp"
+#include <memory>
+#include <string>
+
+namespace jester {
+
+// where the samples end up: signed 16-bit mono at whatever rate the sink
+// was opened with. the apu doesnt care what's behind it
+class AudioSink {
+public:
+  virtual ~AudioSink() = default;
+
+  // true for anything that plays in real time (a sound card). those get
+  // fed from the audio thread with rate control so a full device never
+  // stalls emulation. everything else gets written straight from the
+  // emulation thread with every sample exactly as it came out, so two runs
+  // of the same rom give byte identical files
+  virtual bool isRealtime() const = 0;
+  // false = the samples go nowhere, so the apu doesnt make them at all
+  virtual bool wantsSamples() const { return true; }
+  // allowed to block (device full, pipe full)
+  virtual void write(const s16 *samples, u32 count) = 0;
+};
+
+// picks a sink by name:
+//   ""/"default"  the sound card (pulseaudio, waveout on windows)
+//   "null"        nothing, and no synthesis either
+//   "wav:<path>"  a .wav file
+//   "fd:<n>"      raw s16le to an already open fd (a pipe into aplay,
+//                 ffmpeg, sox...)
+// nullptr if the name is bogus or the thing wont open
+std::unique_ptr<AudioSink> openAudioSink(const std::string &spec,
+                                         u32 sampleRate);
+
+} // namespace jester
@@ -0,0 +1,91 @@
+#include "apu/blip_buffer.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace jester {
+
+BlipBuffer::BlipBuffer(u32 clockRate, u32 sampleRate, u32 maxClocks)
+    : clockRate(clockRate),
+      factor((static_cast<u64>(sampleRate) << FRAC_BITS) / clockRate),
+      maxClocks(maxClocks) {
+  u64 samples = (static_cast<u64>(maxClocks) * factor) >> FRAC_BITS;
+  deltas.resize(samples + samples / 64 + TAPS + 2);
+
+  // one lowpass impulse per sub-sample phase: blackman windowed sinc,
+  // cutoff a bit under nyquist so the window has room to roll off.
+  // each phase gets rounded to add up to exactly 1 << KERNEL_BITS, any
+  // error there would turn into dc drift once its integrated
+  const double pi = 3.14159265358979323846;
+  const double cutoff = 0.9;
+  for (int p = 0; p < PHASES; p++) {
+    double taps[TAPS], sum = 0.0;
+    for (int k = 0; k < TAPS; k++) {
+      double x = k - TAPS / 2 - static_cast<double>(p) / PHASES;
+      double sinc =
+          x == 0.0 ? 1.0 : std::sin(pi * cutoff * x) / (pi * cutoff * x);
+      double w = x / TAPS; // -0.5..0.5 across the kernel
+      double window = std::fabs(w) >= 0.5
+                          ? 0.0
+                          : 0.42 + 0.5 * std::cos(2 * pi * w) +
+                                0.08 * std::cos(4 * pi * w);
+      taps[k] = sinc * window;
+      sum += taps[k];
+    }
+
+    s32 total = 0;
+    for (int k = 0; k < TAPS; k++) {
+      kernel[p][k] = static_cast<s16>(
+          std::lround(taps[k] / sum * (1 << KERNEL_BITS)));
+      total += kernel[p][k];
+    }
+    kernel[p][TAPS / 2] += (1 << KERNEL_BITS) - total;
+  }
+}
+
+void BlipBuffer::clear() {
+  offset = 0;
+  integrator = 0;
+  std::fill(deltas.begin(), deltas.end(), 0);
+}
+
+void BlipBuffer::setSampleRate(double sampleRate) {
+  factor = static_cast<u64>(sampleRate / clockRate * (1ull << FRAC_BITS));
+}
+
+void BlipBuffer::addDelta(u32 time, s32 delta) {
+  u64 pos = offset + time * factor;
+  u64 index = pos >> FRAC_BITS;
+  if (index + TAPS > deltas.size())
+    return; // past the end, nobody read the last frame out
+  const s16 *taps = kernel[(pos >> (FRAC_BITS - PHASE_BITS)) & (PHASES - 1)];
+  s32 *out = &deltas[index];
+  for (int k = 0; k < TAPS; k++)
+    out[k] += delta * taps[k];
+}
+
+void BlipBuffer::endFrame(u32 clocks) {
+  // frames nobody read out just pile up until the buffer is full
+  u64 full = static_cast<u64>(deltas.size() - TAPS - 1) << FRAC_BITS;
+  offset = std::min(offset + std::min(clocks, maxClocks) * factor, full);
+}
+
+u32 BlipBuffer::readSamples(s32 *out, u32 max) {
+  u32 count = std::min(max, samplesAvailable());
+  s32 sum = integrator;
+  for (u32 i = 0; i < count; i++) {
+    sum += deltas[i];
+    out[i] = sum >> KERNEL_BITS;
+    sum -= sum >> 9; // slow leak = highpass, keeps dc from piling up
+  }
+  integrator = sum;
+
+  // slide whats left (incl. the tails of the last steps) to the front
+  size_t left = samplesAvailable() - count + TAPS;
+  std::memmove(deltas.data(), deltas.data() + count, left * sizeof(s32));
+  std::fill(deltas.begin() + left, deltas.begin() + left + count, 0);
+  offset -= static_cast<u64>(count) << FRAC_BITS;
+  return count;
+}
+
+} // namespace jester
@@ -0,0 +1,52 @@
+#pragma once
+
+#include "types.hpp"
+#include <vector>
+
+namespace jester {
+
+// band-limited step synthesis (the blip_buf trick). the channels dont get
+// sampled anymore, they just say "output changed by this much at this
+// cycle". every change gets smeared into the buffer as a band-limited step
+// (a windowed sinc, picked by sub-sample phase) and reading integrates it
+// back into plain samples. no aliasing, and the work scales with how often
+// the output changes instead of with cpu cycles
+class BlipBuffer {
+public:
+  // maxClocks = longest frame endFrame() will ever be called with
+  BlipBuffer(u32 clockRate, u32 sampleRate, u32 maxClocks);
+
+  void clear();
+  // change the output rate on the fly (for rate control). only between
+  // frames, and only by a little: the buffer has room for ~1.5% more
+  void setSampleRate(double sampleRate);
+
+  // output changed by delta at time clocks into the current frame
+  void addDelta(u32 time, s32 delta);
+  // close the frame, everything before clocks can be read now
+  void endFrame(u32 clocks);
+
+  u32 samplesAvailable() const {
+    return static_cast<u32>(offset >> FRAC_BITS);
+  }
+  // not clamped to 16 bits: the highpass can overshoot a full scale step,
+  // so whoever reads applies its volume first and clamps once after that
+  u32 readSamples(s32 *out, u32 max);
+
+private:
+  static constexpr int FRAC_BITS = 32;  // sample position fixed point
+  static constexpr int PHASE_BITS = 6;  // sub-sample kernel resolution
+  static constexpr int PHASES = 1 << PHASE_BITS;
+  static constexpr int TAPS = 16;
+  static constexpr int KERNEL_BITS = 12; // taps of one phase add up to this
+
+  u32 clockRate;
+  u64 factor;     // samples per clock, FRAC_BITS fixed point
+  u64 offset = 0; // where the current frame starts, same units
+  u32 maxClocks;
+  s32 integrator = 0;
+  std::vector<s32> deltas;
+  s16 kernel[PHASES][TAPS];
+};
+
+} // namespace jester
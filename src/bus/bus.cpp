@@ -3,6 +3,8 @@
 #include "cartridge/cartridge.hpp"
 #include "input/input.hpp"
 #include "ppu/ppu.hpp"
+#include "state/state.hpp"
+#include "timer/timer.hpp"
 
 namespace jester {
 
@@ -14,33 +16,108 @@ Bus::Bus() {
 
   // hardware state post-boot (dmg style)
   ie = 0x00;
-  div = 0xAB;
-  tima = 0x00;
-  tma = 0x00;
-  tac = 0xF8;
   sb = 0x00;
   sc = 0x7E;
 
   // Initialize other I/O registers to post-boot values
   ioRegs[0x00] = 0xCF; // JOYP
   ioRegs[0x02] = 0x7E; // SC
-  ioRegs[0x04] = 0xAB; // DIV
-  ioRegs[0x07] = 0xF8; // TAC
   ioRegs[0x0F] = 0xE1; // IF
   ioRegs[0x40] = 0x91; // LCDC
   ioRegs[0x41] = 0x85; // STAT
   ioRegs[0x47] = 0xFC; // BGP
+
+  mapMemory();
 }
 
-void Bus::attachCartridge(Cartridge *cart) { cartridge = cart; }
+void Bus::attachCartridge(Cartridge *cart) {
+  cartridge = cart;
+  mapCartridge();
+}
 
-void Bus::attachPPU(PPU *p) { ppu = p; }
+void Bus::attachPPU(PPU *p) {
+  ppu = p;
+  mapMemory();
+}
 
 void Bus::attachInput(Input *i) { input = i; }
 
 void Bus::attachAPU(APU *a) { apu = a; }
 
-u8 Bus::read(u16 addr) {
+void Bus::attachTimer(Timer *t) { timer = t; }
+
+void Bus::mapMemory() {
+  readPages.fill(nullptr);
+  writePages.fill(nullptr);
+
+  // vram: ppu doesnt lock it by mode so reads are just memory to us.
+  // writes go through the ppu so it knows what to redraw
+  if (ppu) {
+    for (u16 page = 0x80; page <= 0x9F; page++) {
+      readPages[page] = ppu->getVRAM() + (page - 0x80) * 0x100;
+    }
+  }
+
+  // wram + the ghost copy of it
+  for (u16 index = 0; index < 0x20; index++) {
+    wramWatched[index] = false;
+    wramGen[index]++;
+    mapWRAMPage(index);
+  }
+  codeGen++;
+
+  // oam, io and hram share pages with handlers, they stay on the slow path
+
+  mapCartridge();
+}
+
+void Bus::mapWRAMPage(u16 index) {
+  u8 *page = wram.data() + index * 0x100;
+  readPages[0xC0 + index] = page;
+  writePages[0xC0 + index] = wramWatched[index] ? nullptr : page;
+  if (0xE0 + index <= 0xFD) {
+    readPages[0xE0 + index] = page;
+    writePages[0xE0 + index] = wramWatched[index] ? nullptr : page;
+  }
+}
+
+void Bus::watchWRAMPage(u16 addr) {
+  u16 index = (addr - WRAM_START) >> 8;
+  if (wramWatched[index])
+    return;
+  wramWatched[index] = true;
+  mapWRAMPage(index);
+}
+
+// somebody wrote to wram through the slow path, if that page had code
+// decoded out of it the cpu has to throw it away
+void Bus::wramWritten(u16 offset) {
+  u16 index = offset >> 8;
+  if (!wramWatched[index])
+    return;
+  wramWatched[index] = false;
+  wramGen[index]++;
+  codeGen++;
+  mapWRAMPage(index);
+}
+
+void Bus::mapCartridge() {
+  if (cartridge)
+    currentRomBank = cartridge->getROMBank();
+  codeGen++;
+
+  // rom is never written directly, writes there are mbc commands
+  for (u16 page = 0x00; page <= 0x7F; page++) {
+    readPages[page] = cartridge ? cartridge->romPage(page << 8) : nullptr;
+  }
+  // ext ram reads are direct when enabled, writes go through so the
+  // cartridge knows the save is dirty
+  for (u16 page = 0xA0; page <= 0xBF; page++) {
+    readPages[page] = cartridge ? cartridge->ramPage(page << 8) : nullptr;
+  }
+}
+
+u8 Bus::readSlow(u16 addr) {
   // first part of the game code (bank 0)
   if (addr <= 0x3FFF) {
     if (cartridge)
@@ -97,11 +174,13 @@ u8 Bus::read(u16 addr) {
   }
 }
 
-void Bus::write(u16 addr, u8 val) {
+void Bus::writeSlow(u16 addr, u8 val) {
   // cartridge handles its own bank swapping bullshit
   if (addr <= 0x7FFF) {
-    if (cartridge)
+    if (cartridge) {
       cartridge->write(addr, val);
+      mapCartridge();
+    }
   }
   // VRAM (0x8000-0x9FFF)
   else if (addr <= 0x9FFF) {
@@ -116,10 +195,12 @@ void Bus::write(u16 addr, u8 val) {
   // Work RAM (0xC000-0xDFFF)
   else if (addr <= 0xDFFF) {
     wram[addr - WRAM_START] = val;
+    wramWritten(addr - WRAM_START);
   }
   // Echo RAM (0xE000-0xFDFF)
   else if (addr <= 0xFDFF) {
     wram[addr - ECHO_RAM_START] = val;
+    wramWritten(addr - ECHO_RAM_START);
   }
   // OAM (0xFE00-0xFE9F)
   else if (addr <= 0xFE9F) {
@@ -156,14 +237,13 @@ u8 Bus::readIO(u16 addr) {
   case 0xFF02:
     return sc; // Serial control
 
-  case 0xFF04:
-    return div; // DIV
-  case 0xFF05:
-    return tima; // TIMA
-  case 0xFF06:
-    return tma; // TMA
-  case 0xFF07:
-    return tac; // TAC
+  case 0xFF04: // DIV
+  case 0xFF05: // TIMA
+  case 0xFF06: // TMA
+  case 0xFF07: // TAC
+    if (timer)
+      return timer->readRegister(addr);
+    return 0xFF;
 
   case IF_REG:
     return ioRegs[0x0F] | 0xE0; // IF (upper bits always 1)
@@ -215,18 +295,13 @@ void Bus::writeIO(u16 addr, u8 val) {
     sc = val;
     break; // Serial control
 
-  case 0xFF04:
-    div = 0;
-    break; // div: any write resets it back to zero lol
-  case 0xFF05:
-    tima = val;
-    break; // TIMA
-  case 0xFF06:
-    tma = val;
-    break; // TMA
-  case 0xFF07:
-    tac = val;
-    break; // TAC
+  case 0xFF04: // DIV
+  case 0xFF05: // TIMA
+  case 0xFF06: // TMA
+  case 0xFF07: // TAC
+    if (timer)
+      timer->writeRegister(addr, val);
+    break;
 
   case IF_REG:
     ioRegs[0x0F] = val & 0x1F;
@@ -277,6 +352,9 @@ void Bus::doDMATransfer(u8 val) {
 
 u8 Bus::readDirect(u16 addr) const {
   // direct read for debugging (no side effects mfs)
+  const u8 *page = readPages[addr >> 8];
+  if (page)
+    return page[addr & 0xFF];
   if (addr <= 0x3FFF || (addr >= 0x4000 && addr <= 0x7FFF)) {
     if (cartridge)
       return cartridge->readDirect(addr);
@@ -289,4 +367,25 @@ u8 Bus::readDirect(u16 addr) const {
   return 0xFF;
 }
 
+void Bus::serialize(Writer &w) const {
+  w.writeBytes(wram.data(), wram.size());
+  w.writeBytes(hram.data(), hram.size());
+  w.writeBytes(ioRegs.data(), ioRegs.size());
+  w.write8(ie);
+  w.write8(sb);
+  w.write8(sc);
+}
+
+void Bus::deserialize(Reader &r) {
+  r.readBytes(wram.data(), wram.size());
+  r.readBytes(hram.data(), hram.size());
+  r.readBytes(ioRegs.data(), ioRegs.size());
+  ie = r.read8();
+  sb = r.read8();
+  sc = r.read8();
+  // wram just changed under any decoded code, and the cartridge banks may
+  // have moved (it gets loaded first)
+  mapMemory();
+}
+
 } // namespace jester
@@ -9,6 +9,9 @@ class Cartridge;
 class PPU;
 class Input;
 class APU;
+class Timer;
+class Reader;
+class Writer;
 
 class Bus {
 public:
@@ -18,26 +21,76 @@ public:
   void attachPPU(PPU *ppu);
   void attachInput(Input *input);
   void attachAPU(APU *apu);
+  void attachTimer(Timer *timer);
+
+  // fast path: plain memory goes straight through the page table, the rest
+  // (io, oam, mbc registers, unmapped banks) falls back to the slow handlers
+  u8 read(u16 addr) {
+    const u8 *page = readPages[addr >> 8];
+    if (page)
+      return page[addr & 0xFF];
+    return readSlow(addr);
+  }
+  void write(u16 addr, u8 val) {
+    u8 *page = writePages[addr >> 8];
+    if (page) {
+      page[addr & 0xFF] = val;
+      return;
+    }
+    writeSlow(addr, val);
+  }
 
-  u8 read(u16 addr);
-  void write(u16 addr, u8 val);
   void doDMATransfer(u8 val);
+  void requestInterrupt(u8 interrupt) { ioRegs[0x0F] |= interrupt; }
+  u8 pendingInterrupts() const { return ioRegs[0x0F] & ie & 0x1F; }
   u8 readDirect(u16 addr) const; // read without side effects (debug mode only)
 
+  void mapCartridge(); // repoint rom/ext ram pages after a bank switch
+  bool isDirect(u16 addr) const { return readPages[addr >> 8] != nullptr; }
+  u16 romBank() const { return currentRomBank; } // whats at 0x4000 rn
+
+  // code tracking for the cpu block cache. codeGeneration bumps whenever
+  // the code under the cpu could have changed (bank switch, write to a
+  // watched wram page), the per-page generation only for that page
+  u32 codeGeneration() const { return codeGen; }
+  u32 wramPageGeneration(u16 addr) const {
+    return wramGen[(addr - WRAM_START) >> 8];
+  }
+  void watchWRAMPage(u16 addr);
+
+  // save states (see state/state.hpp)
+  void serialize(Writer &w) const;
+  void deserialize(Reader &r);
+
 private:
+  // one entry per 256-byte page, nullptr means "ask the handler"
+  std::array<const u8 *, 0x100> readPages;
+  std::array<u8 *, 0x100> writePages;
+
   std::array<u8, 0x2000> wram;
   std::array<u8, 0x7F> hram;
   std::array<u8, 0x80> ioRegs;
 
+  // wram pages holding decoded code, writes to them take the slow path
+  std::array<u32, 0x20> wramGen{};
+  std::array<bool, 0x20> wramWatched{};
+  u32 codeGen = 0;
+  u16 currentRomBank = 1;
+
   u8 ie;
   Cartridge *cartridge = nullptr;
   PPU *ppu = nullptr;
   Input *input = nullptr;
   APU *apu = nullptr;
+  Timer *timer = nullptr;
 
-  u8 div, tima, tma, tac;
   u8 sb, sc;
 
+  void mapMemory();
+  void mapWRAMPage(u16 index);
+  void wramWritten(u16 offset);
+  u8 readSlow(u16 addr);
+  void writeSlow(u16 addr, u8 val);
   u8 readIO(u16 addr);
   void writeIO(u16 addr, u8 val);
 };
@@ -1,4 +1,5 @@
 #include "cartridge/cartridge.hpp"
+#include "state/state.hpp"
 #include <algorithm>
 #include <fstream>
 #include <iostream>
@@ -56,6 +57,7 @@ bool Cartridge::load(const std::string &path) {
   ramEnabled = false;
   romRamMode = false;
   ramDirty = false;
+  updateBankOffset();
 
   // load existing save if we have one (and it has a battery)
   if (battery && !ram.empty()) {
@@ -124,7 +126,11 @@ void Cartridge::loadRAM() {
 
 u8 Cartridge::read(u16 addr) const { return readMBC(addr); }
 
-void Cartridge::write(u16 addr, u8 val) { writeMBC(addr, val); }
+void Cartridge::write(u16 addr, u8 val) {
+  writeMBC(addr, val);
+  if (addr <= 0x7FFF)
+    updateBankOffset();
+}
 
 u8 Cartridge::readDirect(u16 addr) const {
   if (addr < rom.size()) {
@@ -133,6 +139,65 @@ u8 Cartridge::readDirect(u16 addr) const {
   return 0xFF;
 }
 
+void Cartridge::updateBankOffset() {
+  // banking logic lives here so reads dont redo the switch every byte
+  u32 bank;
+
+  switch (mbcType) {
+  case 0x01: // MBC1
+  case 0x02:
+  case 0x03:
+  case 0x0F: // MBC3
+  case 0x10:
+  case 0x11:
+  case 0x12:
+  case 0x13:
+    bank = romBank;
+    if (bank == 0)
+      bank = 1;
+    break;
+
+  case 0x05: // MBC2
+  case 0x06:
+    bank = romBank & 0x0F;
+    if (bank == 0)
+      bank = 1;
+    break;
+
+  case 0x19: // MBC5
+  case 0x1A:
+  case 0x1B:
+  case 0x1C:
+  case 0x1D:
+  case 0x1E:
+    bank = romBank;
+    break;
+
+  default: // No MBC
+    bank = 1;
+    break;
+  }
+
+  romBankOffset = bank * 0x4000;
+}
+
+const u8 *Cartridge::romPage(u16 addr) const {
+  u32 offset = (addr <= 0x3FFF) ? (addr & 0xFF00)
+                                : romBankOffset + ((addr - 0x4000) & 0xFF00);
+  if (addr > 0x7FFF || offset + 0x100 > rom.size())
+    return nullptr;
+  return rom.data() + offset;
+}
+
+const u8 *Cartridge::ramPage(u16 addr) const {
+  if (!ramEnabled || addr < 0xA000 || addr > 0xBFFF)
+    return nullptr;
+  u32 offset = ((addr - 0xA000) & 0xFF00) + (ramBank * 0x2000);
+  if (offset + 0x100 > ram.size())
+    return nullptr;
+  return ram.data() + offset;
+}
+
 u8 Cartridge::readMBC(u16 addr) const {
   // ROM Bank 0 (0x0000-0x3FFF)
   if (addr <= 0x3FFF) {
@@ -141,61 +206,9 @@ u8 Cartridge::readMBC(u16 addr) const {
     }
     return 0xFF;
   }
-  // the rest of the rom (bank n) - banking logic ahead
+  // the rest of the rom (bank n) - offset is worked out on bank switch
   else if (addr <= 0x7FFF) {
-    u32 bankAddr;
-
-    switch (mbcType) {
-    case 0x00: // No MBC
-      bankAddr = addr;
-      break;
-
-    case 0x01: // MBC1
-    case 0x02:
-    case 0x03: {
-      u8 bank = romBank;
-      if (bank == 0)
-        bank = 1;
-      bankAddr = (addr - 0x4000) + (bank * 0x4000);
-      break;
-    }
-
-    case 0x05: // MBC2
-    case 0x06: {
-      u8 bank = romBank & 0x0F;
-      if (bank == 0)
-        bank = 1;
-      bankAddr = (addr - 0x4000) + (bank * 0x4000);
-      break;
-    }
-
-    case 0x0F: // MBC3
-    case 0x10:
-    case 0x11:
-    case 0x12:
-    case 0x13: {
-      u8 bank = romBank;
-      if (bank == 0)
-        bank = 1;
-      bankAddr = (addr - 0x4000) + (bank * 0x4000);
-      break;
-    }
-
-    case 0x19: // MBC5
-    case 0x1A:
-    case 0x1B:
-    case 0x1C:
-    case 0x1D:
-    case 0x1E: {
-      bankAddr = (addr - 0x4000) + (romBank * 0x4000);
-      break;
-    }
-
-    default:
-      bankAddr = addr;
-      break;
-    }
-
+    u32 bankAddr = romBankOffset + (addr - 0x4000);
     if (bankAddr < rom.size()) {
       return rom[bankAddr];
     }
@@ -339,4 +352,24 @@ void Cartridge::writeMBC(u16 addr, u8 val) {
   }
 }
 
+// rom is the rom, only ram and the mbc registers change
+void Cartridge::serialize(Writer &w) const {
+  w.writeBytes(ram.data(), ram.size());
+  w.write8(romBank);
+  w.write8(ramBank);
+  w.writeBool(ramEnabled);
+  w.writeBool(romRamMode);
+  w.write32(romBankOffset);
+}
+
+void Cartridge::deserialize(Reader &r) {
+  r.readBytes(ram.data(), ram.size());
+  romBank = r.read8();
+  ramBank = r.read8();
+  ramEnabled = r.readBool();
+  romRamMode = r.readBool();
+  romBankOffset = r.read32();
+  ramDirty = true; // ram came from somewhere else, battery save is stale
+}
+
 } // namespace jester
@@ -7,6 +7,8 @@
 
 namespace jester {
 
+class Reader;
+class Writer;
 class Cartridge {
 public:
   Cartridge() = default;
@@ -17,6 +19,11 @@ public:
   void write(u16 addr, u8 val);
   u8 readDirect(u16 addr) const;
 
+  // host pointers for one 256-byte page of the current mapping, or nullptr
+  // when the page has to go through read()/write() (bus page table uses these)
+  const u8 *romPage(u16 addr) const;
+  const u8 *ramPage(u16 addr) const;
+
   void saveRAM();
   void loadRAM();
 
@@ -24,8 +31,16 @@ public:
   u8 getMBCType() const { return mbcType; }
   u32 getROMSize() const { return rom.size(); }
   u32 getRAMSize() const { return ram.size(); }
+  u16 getROMBank() const { return romBankOffset / 0x4000; }
   bool isLoaded() const { return !rom.empty(); }
   bool hasBattery() const { return battery; }
+  u16 getGlobalChecksum() const {
+    return rom.size() > 0x14F ? (rom[0x14E] << 8) | rom[0x14F] : 0;
+  }
+
+  // save states (see state/state.hpp)
+  void serialize(Writer &w) const;
+  void deserialize(Reader &r);
 
 private:
   std::vector<u8> rom;
@@ -41,8 +56,10 @@ private:
   bool ramEnabled = false;
   bool romRamMode = false;
   bool ramDirty = false;
+  u32 romBankOffset = 0x4000; // where 0x4000 lands in the rom right now
 
   void parseHeader();
+  void updateBankOffset();
   u8 readMBC(u16 addr) const;
   void writeMBC(u16 addr, u8 val);
 };
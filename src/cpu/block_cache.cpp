@@ -0,0 +1,168 @@
+#include "cpu/block_cache.hpp"
+#include "bus/bus.hpp"
+#include "cpu/opcodes.hpp"
+
+namespace jester {
+
+// registers that only ever change when a scheduled event fires
+static bool isPolledRegister(u16 addr) {
+  return addr == LY || addr == STAT || addr == IF_REG;
+}
+
+// a busy-wait like "ldh a,(44) / cp 90 / jr nz,loop": it loads a polled
+// register into a first, only touches a and f after that and jumps back
+// to its own start. every lap between two events does exactly the same
+// thing, so the cpu is free to skip them
+static bool isIdleLoop(const BlockCache::Block &block, u32 end) {
+  if (block.count < 2)
+    return false;
+
+  for (u8 i = 0; i + 1 < block.count; i++) {
+    const BlockCache::DecodedOp &op = block.ops[i];
+    switch (op.opcode) {
+    case 0xF0: // LDH A,(a8)
+      if (!isPolledRegister(0xFF00 + op.operand))
+        return false;
+      break;
+    case 0xFA: // LD A,(a16)
+      if (!isPolledRegister(op.operand))
+        return false;
+      break;
+    case 0xE6: // AND d8
+    case 0xF6: // OR d8
+    case 0xEE: // XOR d8
+    case 0xFE: // CP d8
+    case 0xA7: // AND A
+    case 0xB7: // OR A
+      if (i == 0)
+        return false;
+      break;
+    case 0xCB: // BIT n,A
+      if (i == 0 || (op.operand & 0xC7) != 0x47)
+        return false;
+      break;
+    default:
+      return false;
+    }
+  }
+
+  const BlockCache::DecodedOp &last = block.ops[block.count - 1];
+  switch (last.opcode) {
+  case 0x18:
+  case 0x20:
+  case 0x28:
+  case 0x30:
+  case 0x38: // JR
+    return static_cast<u16>(end + static_cast<s8>(last.operand)) ==
+           block.start;
+  case 0xC2:
+  case 0xC3:
+  case 0xCA:
+  case 0xD2:
+  case 0xDA: // JP
+    return last.operand == block.start;
+  default:
+    return false;
+  }
+}
+
+BlockCache::BlockCache(Bus &bus) : bus(bus) { clear(); }
+
+void BlockCache::clear() {
+  blocks.clear();
+  fixedIndex.fill(0);
+  romIndex.clear();
+  wramIndex.fill(0);
+  wramChurn.fill(0);
+}
+
+u32 *BlockCache::slotFor(u16 pc) {
+  if (pc <= 0x7FFF) {
+    if (!bus.isDirect(pc))
+      return nullptr;
+    if (pc <= 0x3FFF)
+      return &fixedIndex[pc];
+    // absolute rom offset of pc, split into 16k chunks
+    u32 offset = static_cast<u32>(bus.romBank()) * 0x4000 + (pc & 0x3FFF);
+    u32 chunk = offset >> 14;
+    if (chunk >= romIndex.size())
+      romIndex.resize(chunk + 1);
+    if (!romIndex[chunk]) {
+      romIndex[chunk] = std::make_unique<Index>();
+      romIndex[chunk]->fill(0);
+    }
+    return &(*romIndex[chunk])[offset & 0x3FFF];
+  }
+  if (pc >= WRAM_START && pc <= WRAM_END) {
+    if (wramChurn[(pc - WRAM_START) >> 8] >= CHURN_LIMIT)
+      return nullptr;
+    return &wramIndex[pc - WRAM_START];
+  }
+  return nullptr;
+}
+
+const BlockCache::Block *BlockCache::lookup(u16 pc) {
+  u32 *slot = slotFor(pc);
+  if (!slot)
+    return nullptr;
+
+  if (*slot) {
+    Block &block = blocks[*slot - 1];
+    if (pc <= 0x7FFF || block.generation == bus.wramPageGeneration(pc))
+      return block.count ? &block : nullptr;
+    // the code got written over, decode it again in the same spot
+    wramChurn[(pc - WRAM_START) >> 8]++;
+    return decode(block, pc) ? &block : nullptr;
+  }
+
+  blocks.emplace_back();
+  *slot = blocks.size();
+  Block &block = blocks.back();
+  return decode(block, pc) ? &block : nullptr;
+}
+
+bool BlockCache::decode(Block &block, u16 pc) {
+  // never run off the end of the region (or the wram page) pc is in, the
+  // next one could be mapped to something else entirely
+  u32 end;
+  if (pc <= 0x3FFF)
+    end = 0x4000;
+  else if (pc <= 0x7FFF)
+    end = 0x8000;
+  else
+    end = (pc & 0xFF00) + 0x100;
+
+  block.start = pc;
+  block.count = 0;
+  if (pc >= WRAM_START) {
+    block.generation = bus.wramPageGeneration(pc);
+    bus.watchWRAMPage(pc);
+  }
+
+  u32 addr = pc;
+  while (block.count < MAX_OPS) {
+    u8 opcode = bus.readDirect(addr);
+    u8 length = OPCODE_LENGTH[opcode];
+    if (addr + length > end)
+      break;
+
+    DecodedOp &op = block.ops[block.count++];
+    op.opcode = opcode;
+    op.length = length;
+    op.cycles = OPCODE_CYCLES[opcode];
+    op.operand = 0;
+    if (length >= 2)
+      op.operand = bus.readDirect(addr + 1);
+    if (length == 3)
+      op.operand |= static_cast<u16>(bus.readDirect(addr + 2)) << 8;
+
+    addr += length;
+    if (OPCODE_ENDS_BLOCK[opcode])
+      break;
+  }
+
+  block.idleLoop = isIdleLoop(block, addr);
+  return block.count != 0;
+}
+
+} // namespace jester
@@ -0,0 +1,61 @@
+#pragma once
+
+#include "types.hpp"
+#include <array>
+#include <memory>
+#include <vector>
+
+namespace jester {
+
+class Bus;
+
+// pre-decoded straight-line runs of code so the cpu doesnt refetch and
+// re-look-up the same bytes every time it loops through them.
+// rom blocks are keyed by where they sit in the rom so a bank switch never
+// has to throw anything away (0x0000 gets its own table: on mbc5 bank 0
+// can show up at 0x4000 too, and a block only fits the window it was
+// decoded in). wram blocks get dropped when their page is written to
+class BlockCache {
+public:
+  static constexpr u8 MAX_OPS = 32;
+
+  struct DecodedOp {
+    u16 operand; // d8/r8/a16, whatever the instruction carries
+    u8 opcode;
+    u8 length;
+    u8 cycles; // base cost, handlers still bump it for taken branches
+  };
+
+  struct Block {
+    u16 start = 0;
+    u8 count = 0;
+    u32 generation = 0; // wram page generation at decode time
+    bool idleLoop = false; // spins on ly/stat/if, see CPU::skipIdleLaps
+    std::array<DecodedOp, MAX_OPS> ops;
+  };
+
+  explicit BlockCache(Bus &bus);
+
+  // nullptr when pc isnt somewhere we cache (hram, vram, cart ram...)
+  const Block *lookup(u16 pc);
+  void clear();
+
+private:
+  using Index = std::array<u32, 0x4000>; // block index + 1, 0 is empty
+
+  // a wram page that keeps getting rewritten isnt worth decoding anymore
+  static constexpr u8 CHURN_LIMIT = 64;
+
+  Bus &bus;
+  std::vector<Block> blocks;
+  Index fixedIndex; // 0x0000-0x3fff
+  // 0x4000-0x7fff by rom offset / 0x4000, made lazily
+  std::vector<std::unique_ptr<Index>> romIndex;
+  std::array<u32, 0x2000> wramIndex;
+  std::array<u8, 0x20> wramChurn;
+
+  u32 *slotFor(u16 pc);
+  bool decode(Block &block, u16 pc);
+};
+
+} // namespace jester
@@ -1,10 +1,16 @@
 #include "cpu/cpu.hpp"
 #include "bus/bus.hpp"
 #include "cpu/opcodes.hpp"
+#include "scheduler/scheduler.hpp"
+#include "state/state.hpp"
+#include <algorithm>
 
 namespace jester {
 
-CPU::CPU(Bus &bus) : bus(bus) { reset(); }
+CPU::CPU(Bus &bus, Scheduler &scheduler)
+    : bus(bus), scheduler(scheduler), blockCache(bus) {
+  reset();
+}
 
 void CPU::reset() {
   // waking up this brain dead dmg cpu
@@ -24,6 +30,8 @@ void CPU::reset() {
   halted = false;
   stopped = false;
   totalCycles = 0;
+  instructionCount = 0;
+  blockCache.clear();
 }
 
 u8 CPU::read8(u16 addr) { return bus.read(addr); }
@@ -257,22 +265,19 @@ u8 CPU::res(u8 n, u8 val) { return val & ~(1 << n); }
 u8 CPU::set(u8 n, u8 val) { return val | (1 << n); }
 
 // jumps and calls lol
-void CPU::jr(bool condition) {
-  s8 offset = static_cast<s8>(fetchByte());
+void CPU::jr(bool condition, u8 offset) {
   if (condition) {
-    pc += offset;
+    pc += static_cast<s8>(offset);
   }
 }
 
-void CPU::jp(bool condition) {
-  u16 addr = fetchWord();
+void CPU::jp(bool condition, u16 addr) {
   if (condition) {
     pc = addr;
   }
 }
 
-void CPU::call(bool condition) {
-  u16 addr = fetchWord();
+void CPU::call(bool condition, u16 addr) {
   if (condition) {
     push16(pc);
     pc = addr;
@@ -291,10 +296,7 @@ void CPU::rst(u8 vec) {
 }
 
 // ask for attention (interrupts)
-void CPU::requestInterrupt(u8 interrupt) {
-  u8 ifReg = read8(IF_REG);
-  write8(IF_REG, ifReg | interrupt);
-}
+void CPU::requestInterrupt(u8 interrupt) { bus.requestInterrupt(interrupt); }
 
 // dealing with interrupts
 void CPU::handleInterrupts() {
@@ -358,6 +360,7 @@ u32 CPU::step() {
   // if halted, just chill for 4 cycles
   if (halted) {
     totalCycles += 4;
+    scheduler.advance(4);
     return 4;
   }
 
@@ -365,871 +368,214 @@ u32 CPU::step() {
   u8 opcode = fetchByte();
   u32 cycles = executeOpcode(opcode);
   totalCycles += cycles;
+  instructionCount++;
+  scheduler.advance(cycles);
   return cycles;
 }
 
-u32 CPU::executeOpcode(u8 opcode) {
-  u8 cycles = OPCODE_CYCLES[opcode];
+void CPU::run(u64 limit) {
+  // nobody else needs to hear about it until the next deadline
+  while (scheduler.now() < limit && !scheduler.isDue()) {
+    // halted with nothing pending: only a scheduled event can raise an
+    // interrupt, so skip right up to it in halt-sized steps instead of
+    // going round step() 4 cycles at a time
+    if (halted && !imeScheduled && !bus.pendingInterrupts()) {
+      u64 target = std::min(limit, scheduler.nextDeadline());
+      u32 skip = static_cast<u32>((target - scheduler.now() + 3) & ~u64(3));
+      totalCycles += skip;
+      scheduler.advance(skip);
+      continue;
+    }
 
-  switch (opcode) {
-  // 0x00 - 0x0F
-  case 0x00:
-    break; // NOP
-  case 0x01:
-    setBC(fetchWord());
-    break; // LD BC,d16
-  case 0x02:
-    write8(getBC(), a);
-    break; // LD (BC),A
-  case 0x03:
-    setBC(getBC() + 1);
-    break; // INC BC
-  case 0x04:
-    b = inc8(b);
-    break; // INC B
-  case 0x05:
-    b = dec8(b);
-    break; // DEC B
-  case 0x06:
-    b = fetchByte();
-    break;     // LD B,d8
-  case 0x07: { // RLCA
-    u8 carry = (a >> 7) & 1;
-    a = (a << 1) | carry;
-    setZ(false);
-    setN(false);
-    setH(false);
-    setC(carry);
-    break;
-  }
-  case 0x08:
-    write16(fetchWord(), sp);
-    break; // LD (a16),SP
-  case 0x09:
-    addHL(getBC());
-    break; // ADD HL,BC
-  case 0x0A:
-    a = read8(getBC());
-    break; // LD A,(BC)
-  case 0x0B:
-    setBC(getBC() - 1);
-    break; // DEC BC
-  case 0x0C:
-    c = inc8(c);
-    break; // INC C
-  case 0x0D:
-    c = dec8(c);
-    break; // DEC C
-  case 0x0E:
-    c = fetchByte();
-    break;     // LD C,d8
-  case 0x0F: { // RRCA
-    u8 carry = a & 1;
-    a = (a >> 1) | (carry << 7);
-    setZ(false);
-    setN(false);
-    setH(false);
-    setC(carry);
-    break;
+    // anything out of the ordinary (interrupts, ei delay, halt) and code
+    // the cache wont hold (hram, vram, cart ram) goes through step()
+    if (!imeScheduled && !halted && !(ime && bus.pendingInterrupts())) {
+      const BlockCache::Block *block = blockCache.lookup(pc);
+      if (block) {
+        runBlock(*block, limit);
+        continue;
+      }
+    }
+    step();
   }
+}
 
-  // 0x10 - 0x1F
-  case 0x10:
-    stopped = true;
-    fetchByte();
-    break; // STOP
-  case 0x11:
-    setDE(fetchWord());
-    break; // LD DE,d16
-  case 0x12:
-    write8(getDE(), a);
-    break; // LD (DE),A
-  case 0x13:
-    setDE(getDE() + 1);
-    break; // INC DE
-  case 0x14:
-    d = inc8(d);
-    break; // INC D
-  case 0x15:
-    d = dec8(d);
-    break; // DEC D
-  case 0x16:
-    d = fetchByte();
-    break;     // LD D,d8
-  case 0x17: { // RLA
-    u8 oldCarry = getC() ? 1 : 0;
-    u8 newCarry = (a >> 7) & 1;
-    a = (a << 1) | oldCarry;
-    setZ(false);
-    setN(false);
-    setH(false);
-    setC(newCarry);
-    break;
-  }
-  case 0x18:
-    jr(true);
-    break; // JR r8
-  case 0x19:
-    addHL(getDE());
-    break; // ADD HL,DE
-  case 0x1A:
-    a = read8(getDE());
-    break; // LD A,(DE)
-  case 0x1B:
-    setDE(getDE() - 1);
-    break; // DEC DE
-  case 0x1C:
-    e = inc8(e);
-    break; // INC E
-  case 0x1D:
-    e = dec8(e);
-    break; // DEC E
-  case 0x1E:
-    e = fetchByte();
-    break;     // LD E,d8
-  case 0x1F: { // RRA
-    u8 oldCarry = getC() ? 0x80 : 0;
-    u8 newCarry = a & 1;
-    a = (a >> 1) | oldCarry;
-    setZ(false);
-    setN(false);
-    setH(false);
-    setC(newCarry);
-    break;
+// run a pre-decoded block. no fetching and no length/cycle lookups, the
+// immediates come straight out of the decoded ops. bails out early when
+// a deadline hits, an interrupt shows up or somebody rewrites code/banks
+void CPU::runBlock(const BlockCache::Block &block, u64 limit) {
+#if JESTER_THREADED_DISPATCH
+  // computed goto engine: every handler jumps straight into the next one
+  // through the label table instead of bouncing back up to a switch
+  static void *const dispatchTable[256] = {
+      // 0x
+      &&op_0x00, &&op_0x01, &&op_0x02, &&op_0x03,
+      &&op_0x04, &&op_0x05, &&op_0x06, &&op_0x07,
+      &&op_0x08, &&op_0x09, &&op_0x0A, &&op_0x0B,
+      &&op_0x0C, &&op_0x0D, &&op_0x0E, &&op_0x0F,
+      // 1x
+      &&op_0x10, &&op_0x11, &&op_0x12, &&op_0x13,
+      &&op_0x14, &&op_0x15, &&op_0x16, &&op_0x17,
+      &&op_0x18, &&op_0x19, &&op_0x1A, &&op_0x1B,
+      &&op_0x1C, &&op_0x1D, &&op_0x1E, &&op_0x1F,
+      // 2x
+      &&op_0x20, &&op_0x21, &&op_0x22, &&op_0x23,
+      &&op_0x24, &&op_0x25, &&op_0x26, &&op_0x27,
+      &&op_0x28, &&op_0x29, &&op_0x2A, &&op_0x2B,
+      &&op_0x2C, &&op_0x2D, &&op_0x2E, &&op_0x2F,
+      // 3x
+      &&op_0x30, &&op_0x31, &&op_0x32, &&op_0x33,
+      &&op_0x34, &&op_0x35, &&op_0x36, &&op_0x37,
+      &&op_0x38, &&op_0x39, &&op_0x3A, &&op_0x3B,
+      &&op_0x3C, &&op_0x3D, &&op_0x3E, &&op_0x3F,
+      // 4x
+      &&op_0x40, &&op_0x41, &&op_0x42, &&op_0x43,
+      &&op_0x44, &&op_0x45, &&op_0x46, &&op_0x47,
+      &&op_0x48, &&op_0x49, &&op_0x4A, &&op_0x4B,
+      &&op_0x4C, &&op_0x4D, &&op_0x4E, &&op_0x4F,
+      // 5x
+      &&op_0x50, &&op_0x51, &&op_0x52, &&op_0x53,
+      &&op_0x54, &&op_0x55, &&op_0x56, &&op_0x57,
+      &&op_0x58, &&op_0x59, &&op_0x5A, &&op_0x5B,
+      &&op_0x5C, &&op_0x5D, &&op_0x5E, &&op_0x5F,
+      // 6x
+      &&op_0x60, &&op_0x61, &&op_0x62, &&op_0x63,
+      &&op_0x64, &&op_0x65, &&op_0x66, &&op_0x67,
+      &&op_0x68, &&op_0x69, &&op_0x6A, &&op_0x6B,
+      &&op_0x6C, &&op_0x6D, &&op_0x6E, &&op_0x6F,
+      // 7x
+      &&op_0x70, &&op_0x71, &&op_0x72, &&op_0x73,
+      &&op_0x74, &&op_0x75, &&op_0x76, &&op_0x77,
+      &&op_0x78, &&op_0x79, &&op_0x7A, &&op_0x7B,
+      &&op_0x7C, &&op_0x7D, &&op_0x7E, &&op_0x7F,
+      // 8x
+      &&op_0x80, &&op_0x81, &&op_0x82, &&op_0x83,
+      &&op_0x84, &&op_0x85, &&op_0x86, &&op_0x87,
+      &&op_0x88, &&op_0x89, &&op_0x8A, &&op_0x8B,
+      &&op_0x8C, &&op_0x8D, &&op_0x8E, &&op_0x8F,
+      // 9x
+      &&op_0x90, &&op_0x91, &&op_0x92, &&op_0x93,
+      &&op_0x94, &&op_0x95, &&op_0x96, &&op_0x97,
+      &&op_0x98, &&op_0x99, &&op_0x9A, &&op_0x9B,
+      &&op_0x9C, &&op_0x9D, &&op_0x9E, &&op_0x9F,
+      // Ax
+      &&op_0xA0, &&op_0xA1, &&op_0xA2, &&op_0xA3,
+      &&op_0xA4, &&op_0xA5, &&op_0xA6, &&op_0xA7,
+      &&op_0xA8, &&op_0xA9, &&op_0xAA, &&op_0xAB,
+      &&op_0xAC, &&op_0xAD, &&op_0xAE, &&op_0xAF,
+      // Bx
+      &&op_0xB0, &&op_0xB1, &&op_0xB2, &&op_0xB3,
+      &&op_0xB4, &&op_0xB5, &&op_0xB6, &&op_0xB7,
+      &&op_0xB8, &&op_0xB9, &&op_0xBA, &&op_0xBB,
+      &&op_0xBC, &&op_0xBD, &&op_0xBE, &&op_0xBF,
+      // Cx
+      &&op_0xC0, &&op_0xC1, &&op_0xC2, &&op_0xC3,
+      &&op_0xC4, &&op_0xC5, &&op_0xC6, &&op_0xC7,
+      &&op_0xC8, &&op_0xC9, &&op_0xCA, &&op_0xCB,
+      &&op_0xCC, &&op_0xCD, &&op_0xCE, &&op_0xCF,
+      // Dx
+      &&op_0xD0, &&op_0xD1, &&op_0xD2, &&op_default,
+      &&op_0xD4, &&op_0xD5, &&op_0xD6, &&op_0xD7,
+      &&op_0xD8, &&op_0xD9, &&op_0xDA, &&op_default,
+      &&op_0xDC, &&op_default, &&op_0xDE, &&op_0xDF,
+      // Ex
+      &&op_0xE0, &&op_0xE1, &&op_0xE2, &&op_default,
+      &&op_default, &&op_0xE5, &&op_0xE6, &&op_0xE7,
+      &&op_0xE8, &&op_0xE9, &&op_0xEA, &&op_default,
+      &&op_default, &&op_default, &&op_0xEE, &&op_0xEF,
+      // Fx
+      &&op_0xF0, &&op_0xF1, &&op_0xF2, &&op_0xF3,
+      &&op_default, &&op_0xF5, &&op_0xF6, &&op_0xF7,
+      &&op_0xF8, &&op_0xF9, &&op_0xFA, &&op_0xFB,
+      &&op_default, &&op_default, &&op_0xFE, &&op_0xFF,
+  };
+#endif
+
+  const BlockCache::DecodedOp *op = block.ops.data();
+  const BlockCache::DecodedOp *end = op + block.count;
+  const u32 generation = bus.codeGeneration();
+  u32 lapCycles = 0;
+  u8 cycles;
+
+dispatch:
+  pc += op->length;
+  cycles = op->cycles;
+#define IMM8 static_cast<u8>(op->operand)
+#define IMM16 op->operand
+#if JESTER_THREADED_DISPATCH
+  goto *dispatchTable[op->opcode];
+
+#define OP(n) op_##n:
+#define OP_DEFAULT op_default:
+#define NEXT goto next
+#include "cpu/execute.inc"
+#undef OP
+#undef OP_DEFAULT
+#undef NEXT
+#else
+  switch (op->opcode) {
+#define OP(n) case n:
+#define OP_DEFAULT default:
+#define NEXT goto next
+#include "cpu/execute.inc"
+#undef OP
+#undef OP_DEFAULT
+#undef NEXT
   }
+#endif
+#undef IMM8
+#undef IMM16
 
-  // 0x20 - 0x2F
-  case 0x20:
-    jr(!getZ());
-    if (!getZ())
-      cycles = CYCLES_JR_TAKEN;
-    break; // JR NZ,r8
-  case 0x21:
-    setHL(fetchWord());
-    break; // LD HL,d16
-  case 0x22:
-    write8(getHL(), a);
-    setHL(getHL() + 1);
-    break; // LD (HL+),A
-  case 0x23:
-    setHL(getHL() + 1);
-    break; // INC HL
-  case 0x24:
-    h = inc8(h);
-    break; // INC H
-  case 0x25:
-    h = dec8(h);
-    break; // DEC H
-  case 0x26:
-    h = fetchByte();
-    break;     // LD H,d8
-  case 0x27: { // DAA
-    u8 correction = 0;
-    bool setCarry = false;
-    if (getH() || (!getN() && (a & 0x0F) > 9)) {
-      correction |= 0x06;
-    }
-    if (getC() || (!getN() && a > 0x99)) {
-      correction |= 0x60;
-      setCarry = true;
-    }
-    a += getN() ? -correction : correction;
-    setZ(a == 0);
-    setH(false);
-    setC(setCarry);
-    break;
+next:
+  totalCycles += cycles;
+  instructionCount++;
+  scheduler.advance(cycles);
+  lapCycles += cycles;
+  if (++op == end) {
+    if (block.idleLoop && pc == block.start)
+      skipIdleLaps(block.count, lapCycles, limit);
+    return;
   }
-  case 0x28:
-    jr(getZ());
-    if (getZ())
-      cycles = CYCLES_JR_TAKEN;
-    break; // JR Z,r8
-  case 0x29:
-    addHL(getHL());
-    break; // ADD HL,HL
-  case 0x2A:
-    a = read8(getHL());
-    setHL(getHL() + 1);
-    break; // LD A,(HL+)
-  case 0x2B:
-    setHL(getHL() - 1);
-    break; // DEC HL
-  case 0x2C:
-    l = inc8(l);
-    break; // INC L
-  case 0x2D:
-    l = dec8(l);
-    break; // DEC L
-  case 0x2E:
-    l = fetchByte();
-    break; // LD L,d8
-  case 0x2F:
-    a = ~a;
-    setN(true);
-    setH(true);
-    break; // CPL
-
-  // 0x30 - 0x3F
-  case 0x30:
-    jr(!getC());
-    if (!getC())
-      cycles = CYCLES_JR_TAKEN;
-    break; // JR NC,r8
-  case 0x31:
-    sp = fetchWord();
-    break; // LD SP,d16
-  case 0x32:
-    write8(getHL(), a);
-    setHL(getHL() - 1);
-    break; // LD (HL-),A
-  case 0x33:
-    sp++;
-    break; // INC SP
-  case 0x34:
-    write8(getHL(), inc8(read8(getHL())));
-    break; // INC (HL)
-  case 0x35:
-    write8(getHL(), dec8(read8(getHL())));
-    break; // DEC (HL)
-  case 0x36:
-    write8(getHL(), fetchByte());
-    break; // LD (HL),d8
-  case 0x37:
-    setN(false);
-    setH(false);
-    setC(true);
-    break; // SCF
-  case 0x38:
-    jr(getC());
-    if (getC())
-      cycles = CYCLES_JR_TAKEN;
-    break; // JR C,r8
-  case 0x39:
-    addHL(sp);
-    break; // ADD HL,SP
-  case 0x3A:
-    a = read8(getHL());
-    setHL(getHL() - 1);
-    break; // LD A,(HL-)
-  case 0x3B:
-    sp--;
-    break; // DEC SP
-  case 0x3C:
-    a = inc8(a);
-    break; // INC A
-  case 0x3D:
-    a = dec8(a);
-    break; // DEC A
-  case 0x3E:
-    a = fetchByte();
-    break; // LD A,d8
-  case 0x3F:
-    setN(false);
-    setH(false);
-    setC(!getC());
-    break; // CCF
-
-  // 0x40 - 0x4F: LD B/C,r
-  case 0x40:
-    break; // LD B,B
-  case 0x41:
-    b = c;
-    break;
-  case 0x42:
-    b = d;
-    break;
-  case 0x43:
-    b = e;
-    break;
-  case 0x44:
-    b = h;
-    break;
-  case 0x45:
-    b = l;
-    break;
-  case 0x46:
-    b = read8(getHL());
-    break;
-  case 0x47:
-    b = a;
-    break;
-  case 0x48:
-    c = b;
-    break;
-  case 0x49:
-    break; // LD C,C
-  case 0x4A:
-    c = d;
-    break;
-  case 0x4B:
-    c = e;
-    break;
-  case 0x4C:
-    c = h;
-    break;
-  case 0x4D:
-    c = l;
-    break;
-  case 0x4E:
-    c = read8(getHL());
-    break;
-  case 0x4F:
-    c = a;
-    break;
-
-  // 0x50 - 0x5F: LD D/E,r
-  case 0x50:
-    d = b;
-    break;
-  case 0x51:
-    d = c;
-    break;
-  case 0x52:
-    break; // LD D,D
-  case 0x53:
-    d = e;
-    break;
-  case 0x54:
-    d = h;
-    break;
-  case 0x55:
-    d = l;
-    break;
-  case 0x56:
-    d = read8(getHL());
-    break;
-  case 0x57:
-    d = a;
-    break;
-  case 0x58:
-    e = b;
-    break;
-  case 0x59:
-    e = c;
-    break;
-  case 0x5A:
-    e = d;
-    break;
-  case 0x5B:
-    break; // LD E,E
-  case 0x5C:
-    e = h;
-    break;
-  case 0x5D:
-    e = l;
-    break;
-  case 0x5E:
-    e = read8(getHL());
-    break;
-  case 0x5F:
-    e = a;
-    break;
-
-  // 0x60 - 0x6F: LD H/L,r
-  case 0x60:
-    h = b;
-    break;
-  case 0x61:
-    h = c;
-    break;
-  case 0x62:
-    h = d;
-    break;
-  case 0x63:
-    h = e;
-    break;
-  case 0x64:
-    break; // LD H,H
-  case 0x65:
-    h = l;
-    break;
-  case 0x66:
-    h = read8(getHL());
-    break;
-  case 0x67:
-    h = a;
-    break;
-  case 0x68:
-    l = b;
-    break;
-  case 0x69:
-    l = c;
-    break;
-  case 0x6A:
-    l = d;
-    break;
-  case 0x6B:
-    l = e;
-    break;
-  case 0x6C:
-    l = h;
-    break;
-  case 0x6D:
-    break; // LD L,L
-  case 0x6E:
-    l = read8(getHL());
-    break;
-  case 0x6F:
-    l = a;
-    break;
-
-  // 0x70 - 0x7F: LD (HL),r and LD A,r
-  case 0x70:
-    write8(getHL(), b);
-    break;
-  case 0x71:
-    write8(getHL(), c);
-    break;
-  case 0x72:
-    write8(getHL(), d);
-    break;
-  case 0x73:
-    write8(getHL(), e);
-    break;
-  case 0x74:
-    write8(getHL(), h);
-    break;
-  case 0x75:
-    write8(getHL(), l);
-    break;
-  case 0x76:
-    halted = true;
-    break; // HALT
-  case 0x77:
-    write8(getHL(), a);
-    break;
-  case 0x78:
-    a = b;
-    break;
-  case 0x79:
-    a = c;
-    break;
-  case 0x7A:
-    a = d;
-    break;
-  case 0x7B:
-    a = e;
-    break;
-  case 0x7C:
-    a = h;
-    break;
-  case 0x7D:
-    a = l;
-    break;
-  case 0x7E:
-    a = read8(getHL());
-    break;
-  case 0x7F:
-    break; // LD A,A
-
-  // 0x80 - 0x8F: ADD/ADC A,r
-  case 0x80:
-    add8(b);
-    break;
-  case 0x81:
-    add8(c);
-    break;
-  case 0x82:
-    add8(d);
-    break;
-  case 0x83:
-    add8(e);
-    break;
-  case 0x84:
-    add8(h);
-    break;
-  case 0x85:
-    add8(l);
-    break;
-  case 0x86:
-    add8(read8(getHL()));
-    break;
-  case 0x87:
-    add8(a);
-    break;
-  case 0x88:
-    adc8(b);
-    break;
-  case 0x89:
-    adc8(c);
-    break;
-  case 0x8A:
-    adc8(d);
-    break;
-  case 0x8B:
-    adc8(e);
-    break;
-  case 0x8C:
-    adc8(h);
-    break;
-  case 0x8D:
-    adc8(l);
-    break;
-  case 0x8E:
-    adc8(read8(getHL()));
-    break;
-  case 0x8F:
-    adc8(a);
-    break;
+  // ei/di/halt/jumps always end a block so only the outside world can
+  // cut it short
+  if (scheduler.now() < limit && !scheduler.isDue() &&
+      bus.codeGeneration() == generation && !(ime && bus.pendingInterrupts()))
+    goto dispatch;
+}
+
+// a polling loop just went all the way round. nothing it reads (ly, stat,
+// if) can change before the next event fires, so every lap until then is
+// a carbon copy of this one. skip the whole laps in one go and let the
+// lap that crosses the deadline run for real
+void CPU::skipIdleLaps(u8 ops, u32 lapCycles, u64 limit) {
+  if (scheduler.isDue() || (ime && bus.pendingInterrupts()))
+    return;
 
-  // 0x90 - 0x9F: SUB/SBC A,r
-  case 0x90:
-    sub8(b);
-    break;
-  case 0x91:
-    sub8(c);
-    break;
-  case 0x92:
-    sub8(d);
-    break;
-  case 0x93:
-    sub8(e);
-    break;
-  case 0x94:
-    sub8(h);
-    break;
-  case 0x95:
-    sub8(l);
-    break;
-  case 0x96:
-    sub8(read8(getHL()));
-    break;
-  case 0x97:
-    sub8(a);
-    break;
-  case 0x98:
-    sbc8(b);
-    break;
-  case 0x99:
-    sbc8(c);
-    break;
-  case 0x9A:
-    sbc8(d);
-    break;
-  case 0x9B:
-    sbc8(e);
-    break;
-  case 0x9C:
-    sbc8(h);
-    break;
-  case 0x9D:
-    sbc8(l);
-    break;
-  case 0x9E:
-    sbc8(read8(getHL()));
-    break;
-  case 0x9F:
-    sbc8(a);
-    break;
+  u64 target = std::min(limit, scheduler.nextDeadline());
+  if (scheduler.now() >= target)
+    return;
 
-  // 0xA0 - 0xAF: AND/XOR A,r
-  case 0xA0:
-    and8(b);
-    break;
-  case 0xA1:
-    and8(c);
-    break;
-  case 0xA2:
-    and8(d);
-    break;
-  case 0xA3:
-    and8(e);
-    break;
-  case 0xA4:
-    and8(h);
-    break;
-  case 0xA5:
-    and8(l);
-    break;
-  case 0xA6:
-    and8(read8(getHL()));
-    break;
-  case 0xA7:
-    and8(a);
-    break;
-  case 0xA8:
-    xor8(b);
-    break;
-  case 0xA9:
-    xor8(c);
-    break;
-  case 0xAA:
-    xor8(d);
-    break;
-  case 0xAB:
-    xor8(e);
-    break;
-  case 0xAC:
-    xor8(h);
-    break;
-  case 0xAD:
-    xor8(l);
-    break;
-  case 0xAE:
-    xor8(read8(getHL()));
-    break;
-  case 0xAF:
-    xor8(a);
-    break;
+  u64 laps = (target - scheduler.now()) / lapCycles;
+  totalCycles += laps * lapCycles;
+  instructionCount += laps * ops;
+  scheduler.advance(static_cast<u32>(laps * lapCycles));
+}
 
-  // 0xB0 - 0xBF: OR/CP A,r
-  case 0xB0:
-    or8(b);
-    break;
-  case 0xB1:
-    or8(c);
-    break;
-  case 0xB2:
-    or8(d);
-    break;
-  case 0xB3:
-    or8(e);
-    break;
-  case 0xB4:
-    or8(h);
-    break;
-  case 0xB5:
-    or8(l);
-    break;
-  case 0xB6:
-    or8(read8(getHL()));
-    break;
-  case 0xB7:
-    or8(a);
-    break;
-  case 0xB8:
-    cp8(b);
-    break;
-  case 0xB9:
-    cp8(c);
-    break;
-  case 0xBA:
-    cp8(d);
-    break;
-  case 0xBB:
-    cp8(e);
-    break;
-  case 0xBC:
-    cp8(h);
-    break;
-  case 0xBD:
-    cp8(l);
-    break;
-  case 0xBE:
-    cp8(read8(getHL()));
-    break;
-  case 0xBF:
-    cp8(a);
-    break;
+u32 CPU::executeOpcode(u8 opcode) {
+  u8 cycles = OPCODE_CYCLES[opcode];
 
-  // 0xC0 - 0xCF
-  case 0xC0:
-    ret(!getZ());
-    if (!getZ())
-      cycles = CYCLES_RET_TAKEN;
-    break; // RET NZ
-  case 0xC1:
-    setBC(pop16());
-    break; // POP BC
-  case 0xC2:
-    jp(!getZ());
-    if (!getZ())
-      cycles = CYCLES_JP_TAKEN;
-    break; // JP NZ,a16
-  case 0xC3:
-    pc = fetchWord();
-    break; // JP a16
-  case 0xC4:
-    call(!getZ());
-    if (!getZ())
-      cycles = CYCLES_CALL_TAKEN;
-    break; // CALL NZ,a16
-  case 0xC5:
-    push16(getBC());
-    break; // PUSH BC
-  case 0xC6:
-    add8(fetchByte());
-    break; // ADD A,d8
-  case 0xC7:
-    rst(0x00);
-    break; // RST 00H
-  case 0xC8:
-    ret(getZ());
-    if (getZ())
-      cycles = CYCLES_RET_TAKEN;
-    break; // RET Z
-  case 0xC9:
-    pc = pop16();
-    break; // RET
-  case 0xCA:
-    jp(getZ());
-    if (getZ())
-      cycles = CYCLES_JP_TAKEN;
-    break; // JP Z,a16
-  case 0xCB:
-    cycles = executeCBOpcode(fetchByte());
-    break; // CB prefix
-  case 0xCC:
-    call(getZ());
-    if (getZ())
-      cycles = CYCLES_CALL_TAKEN;
-    break; // CALL Z,a16
-  case 0xCD:
-    call(true);
-    break; // CALL a16
-  case 0xCE:
-    adc8(fetchByte());
-    break; // ADC A,d8
-  case 0xCF:
-    rst(0x08);
-    break; // RST 08H
-
-  // 0xD0 - 0xDF
-  case 0xD0:
-    ret(!getC());
-    if (!getC())
-      cycles = CYCLES_RET_TAKEN;
-    break; // RET NC
-  case 0xD1:
-    setDE(pop16());
-    break; // POP DE
-  case 0xD2:
-    jp(!getC());
-    if (!getC())
-      cycles = CYCLES_JP_TAKEN;
-    break; // JP NC,a16
-  // 0xD3 unused
-  case 0xD4:
-    call(!getC());
-    if (!getC())
-      cycles = CYCLES_CALL_TAKEN;
-    break; // CALL NC,a16
-  case 0xD5:
-    push16(getDE());
-    break; // PUSH DE
-  case 0xD6:
-    sub8(fetchByte());
-    break; // SUB d8
-  case 0xD7:
-    rst(0x10);
-    break; // RST 10H
-  case 0xD8:
-    ret(getC());
-    if (getC())
-      cycles = CYCLES_RET_TAKEN;
-    break; // RET C
-  case 0xD9:
-    pc = pop16();
-    ime = true;
-    break; // RETI
-  case 0xDA:
-    jp(getC());
-    if (getC())
-      cycles = CYCLES_JP_TAKEN;
-    break; // JP C,a16
-  // 0xDB unused
-  case 0xDC:
-    call(getC());
-    if (getC())
-      cycles = CYCLES_CALL_TAKEN;
-    break; // CALL C,a16
-  // 0xDD unused
-  case 0xDE:
-    sbc8(fetchByte());
-    break; // SBC A,d8
-  case 0xDF:
-    rst(0x18);
-    break; // RST 18H
-
-  // 0xE0 - 0xEF
-  case 0xE0:
-    write8(0xFF00 + fetchByte(), a);
-    break; // LDH (a8),A
-  case 0xE1:
-    setHL(pop16());
-    break; // POP HL
-  case 0xE2:
-    write8(0xFF00 + c, a);
-    break; // LD (C),A
-  // 0xE3, 0xE4 unused
-  case 0xE5:
-    push16(getHL());
-    break; // PUSH HL
-  case 0xE6:
-    and8(fetchByte());
-    break; // AND d8
-  case 0xE7:
-    rst(0x20);
-    break; // RST 20H
-  case 0xE8:
-    addSP(static_cast<s8>(fetchByte()));
-    break; // ADD SP,r8
-  case 0xE9:
-    pc = getHL();
-    break; // JP HL
-  case 0xEA:
-    write8(fetchWord(), a);
-    break; // LD (a16),A
-  // 0xEB, 0xEC, 0xED unused
-  case 0xEE:
-    xor8(fetchByte());
-    break; // XOR d8
-  case 0xEF:
-    rst(0x28);
-    break; // RST 28H
-
-  // 0xF0 - 0xFF
-  case 0xF0:
-    a = read8(0xFF00 + fetchByte());
-    break; // LDH A,(a8)
-  case 0xF1:
-    setAF(pop16());
-    break; // POP AF
-  case 0xF2:
-    a = read8(0xFF00 + c);
-    break; // LD A,(C)
-  case 0xF3:
-    ime = false;
-    break; // DI
-  // 0xF4 unused
-  case 0xF5:
-    push16(getAF());
-    break; // PUSH AF
-  case 0xF6:
-    or8(fetchByte());
-    break; // OR d8
-  case 0xF7:
-    rst(0x30);
-    break;     // RST 30H
-  case 0xF8: { // LD HL,SP+r8
-    s8 offset = static_cast<s8>(fetchByte());
-    setHL(sp + offset);
-    setZ(false);
-    setN(false);
-    setH(((sp & 0x0F) + (offset & 0x0F)) > 0x0F);
-    setC(((sp & 0xFF) + (offset & 0xFF)) > 0xFF);
-    break;
-  }
-  case 0xF9:
-    sp = getHL();
-    break; // LD SP,HL
-  case 0xFA:
-    a = read8(fetchWord());
-    break; // LD A,(a16)
-  case 0xFB:
-    imeScheduled = true;
-    break; // EI
-  // 0xFC, 0xFD unused
-  case 0xFE:
-    cp8(fetchByte());
-    break; // CP d8
-  case 0xFF:
-    rst(0x38);
-    break; // RST 38H
-
-  default:
-    // Undefined opcode - treat as NOP
-    break;
+  switch (opcode) {
+#define OP(n) case n:
+#define OP_DEFAULT default:
+#define NEXT break
+#define IMM8 fetchByte()
+#define IMM16 fetchWord()
+#include "cpu/execute.inc"
+#undef OP
+#undef OP_DEFAULT
+#undef NEXT
+#undef IMM8
+#undef IMM16
   }
 
   return cycles;
@@ -1348,4 +694,43 @@ u32 CPU::executeCBOpcode(u8 opcode) {
   return cycles;
 }
 
+void CPU::serialize(Writer &w) const {
+  w.write8(a);
+  w.write8(f);
+  w.write8(b);
+  w.write8(c);
+  w.write8(d);
+  w.write8(e);
+  w.write8(h);
+  w.write8(l);
+  w.write16(sp);
+  w.write16(pc);
+  w.writeBool(ime);
+  w.writeBool(halted);
+  w.writeBool(stopped);
+  w.writeBool(imeScheduled);
+  w.write64(totalCycles);
+  w.write64(instructionCount);
+}
+
+void CPU::deserialize(Reader &r) {
+  a = r.read8();
+  f = r.read8();
+  b = r.read8();
+  c = r.read8();
+  d = r.read8();
+  e = r.read8();
+  h = r.read8();
+  l = r.read8();
+  sp = r.read16();
+  pc = r.read16();
+  ime = r.readBool();
+  halted = r.readBool();
+  stopped = r.readBool();
+  imeScheduled = r.readBool();
+  totalCycles = r.read64();
+  instructionCount = r.read64();
+  // rom blocks are still good, wram ones get caught by the bus generations
+}
+
 } // namespace jester
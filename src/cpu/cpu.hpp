@@ -1,16 +1,21 @@
 #pragma once
 
+#include "cpu/block_cache.hpp"
 #include "types.hpp"
 
 namespace jester {
 
 class Bus;
+class Reader;
+class Scheduler;
+class Writer;
 
 class CPU {
 public:
-  explicit CPU(Bus &bus);
+  CPU(Bus &bus, Scheduler &scheduler);
 
   u32 step();
+  void run(u64 limit); // step until limit or the next scheduled event
   void reset();
   void requestInterrupt(u8 interrupt);
 
@@ -19,9 +24,16 @@ public:
   u8 getA() const { return a; }
   u8 getF() const { return f; }
   u64 getTotalCycles() const { return totalCycles; }
+  u64 getInstructionCount() const { return instructionCount; }
+
+  // save states (see state/state.hpp)
+  void serialize(Writer &w) const;
+  void deserialize(Reader &r);
 
 private:
   Bus &bus;
+  Scheduler &scheduler;
+  BlockCache blockCache;
 
   // data buckets (registers)
   u8 a = 0, f = 0;
@@ -37,6 +49,7 @@ private:
   bool stopped = false;
   bool imeScheduled = false;
   u64 totalCycles = 0;
+  u64 instructionCount = 0;
 
   // flags: for when shit happens
   bool getZ() const { return (f & 0x80) != 0; }
@@ -110,13 +123,15 @@ private:
   u8 set(u8 n, u8 val);
 
   // teleportin around (jumps)
-  void jr(bool condition);
-  void jp(bool condition);
-  void call(bool condition);
+  void jr(bool condition, u8 offset);
+  void jp(bool condition, u16 addr);
+  void call(bool condition, u16 addr);
   void ret(bool condition);
   void rst(u8 vec);
 
   void handleInterrupts();
+  void runBlock(const BlockCache::Block &block, u64 limit);
+  void skipIdleLaps(u8 ops, u32 lapCycles, u64 limit);
   u32 executeOpcode(u8 opcode);
   u32 executeCBOpcode(u8 opcode);
 };
@@ -0,0 +1,122 @@
+#include "emulator/emulator.hpp"
+#include "state/state.hpp"
+
+namespace jester {
+
+Emulator::Emulator() : cpu(bus, scheduler) {
+  bus.attachPPU(&ppu);
+  bus.attachAPU(&apu);
+  bus.attachInput(&input);
+  bus.attachTimer(&timer);
+  timer.attachBus(&bus);
+  timer.attachScheduler(&scheduler);
+  ppu.attachBus(&bus);
+  ppu.attachScheduler(&scheduler);
+  apu.reset(); // null sink: registers work, samples go nowhere
+  apu.attachScheduler(&scheduler);
+}
+
+Emulator::~Emulator() {
+  apu.attachScheduler(nullptr);
+  apu.cleanup();
+}
+
+bool Emulator::loadROM(const std::string &path) {
+  if (!cartridge.load(path))
+    return false;
+  bus.attachCartridge(&cartridge);
+  return true;
+}
+
+bool Emulator::enableAudio(const std::string &sink) {
+  return apu.init(sink);
+}
+
+bool Emulator::runFrame() {
+  // cpu runs flat out between deadlines, ppu/apu only wake up for
+  // their own events
+  u64 frameEndCycle = scheduler.now() + CYCLES_PER_FRAME;
+  while (scheduler.now() < frameEndCycle) {
+    cpu.run(frameEndCycle);
+    scheduler.dispatch();
+  }
+  apu.endFrame(); // this frame's audio goes out in one batch
+
+  if (!ppu.isFrameReady())
+    return false;
+  ppu.clearFrameReady();
+  return true;
+}
+
+// header first so a state from another rom (or another version of this
+// format) gets turned away before anything is touched
+void Emulator::writeState(Writer &w) const {
+  w.write32(STATE_MAGIC);
+  w.write16(STATE_VERSION);
+  w.write32(cartridge.getROMSize());
+  w.write16(cartridge.getGlobalChecksum());
+
+  // cartridge before bus: the bus remaps its pages from the mbc state
+  cartridge.serialize(w);
+  bus.serialize(w);
+  cpu.serialize(w);
+  ppu.serialize(w);
+  apu.serialize(w);
+  timer.serialize(w);
+  input.serialize(w);
+  scheduler.serialize(w);
+}
+
+size_t Emulator::stateSize() const {
+  Writer counter(nullptr, 0);
+  writeState(counter);
+  return counter.size();
+}
+
+size_t Emulator::saveState(u8 *buffer, size_t capacity) const {
+  Writer w(buffer, capacity);
+  writeState(w);
+  return w.ok() ? w.size() : 0;
+}
+
+bool Emulator::readHeader(Reader &r) const {
+  return r.read32() == STATE_MAGIC && r.read16() == STATE_VERSION &&
+         r.read32() == cartridge.getROMSize() &&
+         r.read16() == cartridge.getGlobalChecksum();
+}
+
+bool Emulator::loadState(const u8 *data, size_t size) {
+  if (size != stateSize())
+    return false;
+
+  Reader r(data, size);
+  if (!readHeader(r))
+    return false;
+
+  // a body that goes bad halfway through would leave half of one machine
+  // and half of the other, so keep this one around to put back
+  rollback.resize(size);
+  saveState(rollback.data(), rollback.size());
+  readState(r);
+  if (r.ok())
+    return true;
+
+  Reader undo(rollback.data(), rollback.size());
+  readHeader(undo);
+  readState(undo);
+  return false;
+}
+
+// same order as writeState
+void Emulator::readState(Reader &r) {
+  cartridge.deserialize(r);
+  bus.deserialize(r);
+  cpu.deserialize(r);
+  ppu.deserialize(r);
+  apu.deserialize(r);
+  timer.deserialize(r);
+  input.deserialize(r);
+  scheduler.deserialize(r);
+}
+
+} // namespace jester
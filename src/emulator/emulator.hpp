@@ -0,0 +1,80 @@
+#pragma once
+
+#include "apu/apu.hpp"
+#include "bus/bus.hpp"
+#include "cartridge/cartridge.hpp"
+#include "cpu/cpu.hpp"
+#include "input/input.hpp"
+#include "ppu/ppu.hpp"
+#include "scheduler/scheduler.hpp"
+#include "timer/timer.hpp"
+#include "types.hpp"
+#include <array>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace jester {
+
+// one whole game boy with all the wiring done. no terminal, no keyboard and
+// no sound device unless someone asks for it (enableAudio), so a host can
+// run as many of these side by side as it wants (one per thread)
+class Emulator {
+public:
+  Emulator();
+  ~Emulator();
+
+  Emulator(const Emulator &) = delete; // everything points at everything
+  Emulator &operator=(const Emulator &) = delete;
+
+  bool loadROM(const std::string &path);
+  // swap the null sink for a real one, "" = the sound card (see
+  // openAudioSink for files and pipes)
+  bool enableAudio(const std::string &sink = "");
+
+  // run one frame's worth of cycles, true if the ppu finished a picture
+  bool runFrame();
+  // see PPU::setFrameSkip. timing is untouched, only the drawing is skipped
+  void setFrameSkip(u8 n) { ppu.setFrameSkip(n); }
+  void requestFrame() { ppu.requestFrame(); } // with setFrameSkip(0)
+  void setButtons(u8 pressed) { input.setButtons(pressed); } // Input::BTN_*
+  const std::array<u8, 160 * 144> &framebuffer() const {
+    return ppu.getFrameBuffer();
+  }
+  // lines that changed since the drawn frame before, see PPU::getDirtyLines
+  const std::array<bool, 144> &dirtyLines() const {
+    return ppu.getDirtyLines();
+  }
+
+  // save states go into memory the caller owns. stateSize() is fixed for a
+  // given rom so the buffer can be made once (loadState keeps one copy of
+  // its own to roll back to, sized on first use)
+  size_t stateSize() const;
+  size_t saveState(u8 *buffer, size_t capacity) const; // 0 if it didnt fit
+  // false = not ours or broken, either way the running game is untouched
+  bool loadState(const u8 *data, size_t size);
+
+  CPU &getCPU() { return cpu; }
+  APU &getAPU() { return apu; }
+  Cartridge &getCartridge() { return cartridge; }
+  Scheduler &getScheduler() { return scheduler; }
+
+private:
+  // declaration order matters, the cpu holds refs to bus + scheduler
+  Scheduler scheduler;
+  Bus bus;
+  CPU cpu;
+  PPU ppu;
+  APU apu;
+  Timer timer;
+  Cartridge cartridge;
+  Input input;
+
+  std::vector<u8> rollback; // the machine before a loadState, in case
+
+  void writeState(Writer &w) const;
+  bool readHeader(Reader &r) const;
+  void readState(Reader &r); // everything after the header
+};
+
+} // namespace jester
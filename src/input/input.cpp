@@ -1,4 +1,5 @@
 #include "input/input.hpp"
+#include "state/state.hpp"
 #include <cstring>
 
 #ifdef _WIN32
@@ -72,6 +73,7 @@ static bool hasMoreInput() {
 
 void Input::poll() {
   std::memset(buttons, false, sizeof(buttons));
+  rewindRequested = false;
 
 #ifdef _WIN32
   while (_kbhit()) {
@@ -112,6 +114,10 @@ void Input::poll() {
     case 27:
       pauseRequested = true;
       break;
+    case 'r':
+    case 'R':
+      rewindRequested = true; // held = keeps going back, like the buttons
+      break;
     case 'q':
     case 'Q':
       quitRequested = true;
@@ -180,6 +186,10 @@ void Input::poll() {
     case ' ':
       buttons[BTN_SELECT] = true;
       break;
+    case 'r':
+    case 'R':
+      rewindRequested = true; // held = keeps going back, like the buttons
+      break;
     case 'q':
     case 'Q':
       quitRequested = true;
@@ -219,4 +229,25 @@ u8 Input::read() const {
 
 void Input::write(u8 val) { joypadSelect = val & 0x30; }
 
+u8 Input::getButtons() const {
+  u8 pressed = 0;
+  for (u8 i = 0; i < 8; i++) {
+    if (buttons[i])
+      pressed |= 1 << i;
+  }
+  return pressed;
+}
+
+void Input::setButtons(u8 pressed) {
+  for (u8 i = 0; i < 8; i++) {
+    buttons[i] = (pressed >> i) & 1;
+  }
+}
+
+// held buttons belong to whoever is playing, only the select lines are
+// machine state
+void Input::serialize(Writer &w) const { w.write8(joypadSelect); }
+
+void Input::deserialize(Reader &r) { joypadSelect = r.read8() & 0x30; }
+
 } // namespace jester
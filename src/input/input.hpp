@@ -4,8 +4,19 @@
 
 namespace jester {
 
+class Reader;
+class Writer;
 class Input {
 public:
+  static constexpr u8 BTN_RIGHT = 0;
+  static constexpr u8 BTN_LEFT = 1;
+  static constexpr u8 BTN_UP = 2;
+  static constexpr u8 BTN_DOWN = 3;
+  static constexpr u8 BTN_A = 4;
+  static constexpr u8 BTN_B = 5;
+  static constexpr u8 BTN_SELECT = 6;
+  static constexpr u8 BTN_START = 7;
+
   Input();
   ~Input();
 
@@ -16,8 +27,18 @@ public:
   u8 read() const;
   void write(u8 val);
 
+  // one bit per BTN_* (bit 0 = right ... bit 7 = start), set = held.
+  // lets something other than the terminal drive the joypad
+  u8 getButtons() const;
+  void setButtons(u8 pressed);
+
+  // save states (see state/state.hpp)
+  void serialize(Writer &w) const;
+  void deserialize(Reader &r);
+
   bool shouldQuit() const { return quitRequested; }
   bool shouldPause() const { return pauseRequested; }
+  bool shouldRewind() const { return rewindRequested; }
   void clearPause() { pauseRequested = false; }
   void clearQuit() { quitRequested = false; }
 
@@ -27,15 +48,7 @@ private:
   u8 joypadSelect = 0;
   bool quitRequested = false;
   bool pauseRequested = false;
-
-  static constexpr u8 BTN_RIGHT = 0;
-  static constexpr u8 BTN_LEFT = 1;
-  static constexpr u8 BTN_UP = 2;
-  static constexpr u8 BTN_DOWN = 3;
-  static constexpr u8 BTN_A = 4;
-  static constexpr u8 BTN_B = 5;
-  static constexpr u8 BTN_SELECT = 6;
-  static constexpr u8 BTN_START = 7;
+  bool rewindRequested = false;
 };
 
 } // namespace jester
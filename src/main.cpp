@@ -1,18 +1,18 @@
 /* jester-gb: playing pokemon in a shitty terminal. built by bero. */
 
-#include "apu/apu.hpp"
-#include "bus/bus.hpp"
-#include "cartridge/cartridge.hpp"
-#include "cpu/cpu.hpp"
+#include "emulator/emulator.hpp"
 #include "input/input.hpp"
-#include "ppu/ppu.hpp"
+#include "ppu/compositor.hpp"
+#include "rewind/rewind.hpp"
 #include "tui/menu.hpp"
+#include "tui/output_thread.hpp"
 #include "tui/renderer.hpp"
 #include "tui/terminal.hpp"
 #include "types.hpp"
 
 #include <chrono>
 #include <csignal>
+#include <cstdio>
 #include <cstring>
 #include <iostream>
 #include <thread>
@@ -28,6 +28,62 @@ static volatile bool running = true;
 
 void signalHandler(int) { running = false; }
 
+// no terminal, no sleeping, no audio unless --audio says where. just run the
+// rom as fast as the host can go and say how fast that was (capacity
+// planning + perf regressions)
+static int runHeadless(const char *romPath, u32 frames, u32 frameSkip,
+                       bool printHash, const char *audioSink) {
+  Emulator emulator;
+  if (!emulator.loadROM(romPath)) {
+    std::cerr << "Failed to load ROM: " << romPath << "\n";
+    return 1;
+  }
+  // off unless asked for. a file gets every sample of every frame, so two
+  // runs can be diffed
+  if (audioSink && !emulator.enableAudio(audioSink)) {
+    std::cerr << "Failed to open audio sink: " << audioSink << "\n";
+    return 1;
+  }
+  emulator.setFrameSkip(frameSkip);
+
+  using Clock = std::chrono::steady_clock;
+  auto start = Clock::now();
+
+  u32 frame = 0;
+  u32 drawn = 0;
+  for (; frame < frames && running; frame++) {
+    if (emulator.runFrame())
+      drawn++;
+  }
+
+  double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+  const CPU &cpu = emulator.getCPU();
+  if (seconds <= 0.0)
+    seconds = 1e-9;
+
+  std::printf("frames:      %u (%u drawn)\n", frame, drawn);
+  std::printf("wall time:   %.3f s\n", seconds);
+  std::printf("fps:         %.1f (%.1fx realtime)\n", frame / seconds,
+              frame / seconds / (1000.0 / FRAME_TIME_MS));
+  std::printf("MIPS:        %.2f\n",
+              cpu.getInstructionCount() / seconds / 1e6);
+  std::printf("cycles/sec:  %.0f\n", cpu.getTotalCycles() / seconds);
+  std::printf("compositor:  %s\n", compositorName());
+
+  if (printHash) {
+    // fnv-1a over the last drawn frame, good enough to spot a changed
+    // picture
+    u64 hash = 0xCBF29CE484222325ull;
+    for (u8 pixel : emulator.framebuffer()) {
+      hash ^= pixel;
+      hash *= 0x100000001B3ull;
+    }
+    std::printf("frame hash:  %016llx\n",
+                static_cast<unsigned long long>(hash));
+  }
+  return 0;
+}
+
 int main(int argc, char *argv[]) {
 #ifdef _WIN32
   // fix windows shitty timer resolution (15ms -> 1ms)
@@ -38,7 +94,13 @@ int main(int argc, char *argv[]) {
   u8 argPalette = 255;
   int argVolume = -1;
   bool argDebug = false;
+  bool audioSync = false;
+  const char *audioSink = nullptr;
   bool useMenu = true;
+  bool headless = false;
+  bool headlessHash = false;
+  u32 headlessFrames = 3600;
+  u32 headlessSkip = 1;
 
   for (int i = 1; i < argc; i++) {
     if (strcmp(argv[i], "-h") == 0 || strcmp(argv[i], "--help") == 0) {
@@ -48,10 +110,34 @@ int main(int argc, char *argv[]) {
       std::cerr << "  -p <0-4>   Color palette\n";
       std::cerr << "  -v <0-100> Volume level\n";
       std::cerr << "  -d         Enable debug display\n";
+      std::cerr << "  --audio-sync  Pace by the audio device instead of "
+                   "the clock\n";
+      std::cerr << "  --audio <sink>  default, null, wav:<file> or fd:<n> "
+                   "(raw s16le)\n";
       std::cerr << "  -h         Show help\n";
+      std::cerr << "  --headless Run uncapped with no terminal/audio, print "
+                   "stats\n";
+      std::cerr << "  --frames N Frames to run in headless mode (default "
+                   "3600)\n";
+      std::cerr << "  --hash     Print a hash of the last frame (headless)\n";
+      std::cerr << "  --skip N   Only draw every Nth frame (headless)\n";
       return 0;
+    } else if (strcmp(argv[i], "--headless") == 0) {
+      headless = true;
+    } else if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc) {
+      headlessFrames = std::strtoul(argv[++i], nullptr, 10);
+    } else if (strcmp(argv[i], "--hash") == 0) {
+      headlessHash = true;
+    } else if (strcmp(argv[i], "--skip") == 0 && i + 1 < argc) {
+      headlessSkip = std::strtoul(argv[++i], nullptr, 10);
+      if (headlessSkip < 1 || headlessSkip > 255)
+        headlessSkip = 1;
     } else if (strcmp(argv[i], "-d") == 0) {
       argDebug = true;
+    } else if (strcmp(argv[i], "--audio-sync") == 0) {
+      audioSync = true;
+    } else if (strcmp(argv[i], "--audio") == 0 && i + 1 < argc) {
+      audioSink = argv[++i];
     } else if (strcmp(argv[i], "-p") == 0 && i + 1 < argc) {
       argPalette = std::atoi(argv[++i]);
       if (argPalette > 4)
@@ -71,15 +157,26 @@ int main(int argc, char *argv[]) {
   signal(SIGINT, signalHandler);
   signal(SIGTERM, signalHandler);
 
+  if (headless) {
+    if (!directRomPath) {
+      std::cerr << "--headless needs a rom path\n";
+      return 1;
+    }
+    int result = runHeadless(directRomPath, headlessFrames, headlessSkip,
+                             headlessHash, audioSink);
+#ifdef _WIN32
+    timeEndPeriod(1);
+#endif
+    return result;
+  }
+
   Terminal terminal;
   Input input;
   Menu menu;
-  APU apu;
 
   terminal.init();
   input.enableRawMode();
   menu.init(&terminal);
-  menu.setAPU(&apu);
 
   std::string romPath;
   u8 palette;
@@ -104,26 +201,26 @@ int main(int argc, char *argv[]) {
   }
 
   while (running && !romPath.empty()) {
-    Bus bus;
-    CPU cpu(bus);
-    PPU ppu;
-    Cartridge cartridge;
+    Emulator emulator;
+    APU &apu = emulator.getAPU();
+    const CPU &cpu = emulator.getCPU();
 
-    if (!cartridge.load(romPath)) {
+    if (!emulator.loadROM(romPath)) {
       input.disableRawMode();
       terminal.cleanup();
       std::cerr << "Failed to load ROM: " << romPath << "\n";
       return 1;
     }
 
-    bus.attachCartridge(&cartridge);
-    bus.attachPPU(&ppu);
-    bus.attachAPU(&apu);
-    bus.attachInput(&input);
-
-    if (!apu.init()) { /* apu died? idc keep going */
+    if (!emulator.enableAudio(audioSink ? audioSink : "")) {
+      /* apu died? idc keep going */
     }
     apu.setVolume(volume);
+    menu.setAPU(&apu);
+
+    // ~60s of history. deltas are usually well under 1k a frame so the
+    // budget is mostly there for games that churn through all of ram
+    Rewind rewind(emulator.stateSize(), 60, 32 << 20);
 
     Renderer renderer;
     renderer.init(&terminal);
@@ -132,17 +229,26 @@ int main(int argc, char *argv[]) {
     printf("\033[2J");
     renderer.drawBorder();
 
+    // from here on the renderer belongs to the output thread, except
+    // while its paused
+    OutputThread output(renderer);
+
     using Clock = std::chrono::high_resolution_clock;
     auto lastFpsTime = Clock::now();
+    // frames are due on a fixed grid, so oversleeping one frame gets taken
+    // out of the next instead of slowly dragging the whole game (and the
+    // sound with it) below 59.7fps
+    const auto frameTime =
+        std::chrono::microseconds(static_cast<long>(FRAME_TIME_MS * 1000));
+    auto nextFrame = Clock::now();
     u32 frameCount = 0;
     double currentFps = 0.0;
 
     bool gameRunning = true;
 
     while (running && gameRunning) {
-      auto frameStart = Clock::now();
-
       input.poll();
+      emulator.setButtons(input.getButtons());
 
       if (input.shouldQuit()) {
         gameRunning = false;
@@ -152,6 +258,7 @@ int main(int argc, char *argv[]) {
 
       if (input.shouldPause()) {
         input.clearPause();
+        output.pause();
         if (!menu.runPauseMenu(romPath)) {
           gameRunning = false;
           palette = menu.getPalette();
@@ -166,30 +273,18 @@ int main(int argc, char *argv[]) {
         apu.setVolume(volume);
         renderer.setPalette(palette);
         renderer.drawBorder();
+        output.resume();
+        nextFrame = Clock::now(); // dont race to make up for the pause
       }
 
-      u32 frameCycles = 0;
-      while (frameCycles < CYCLES_PER_FRAME) {
-        u32 cycles = cpu.step();
-        ppu.step(cycles);
-        apu.step(cycles);
-        frameCycles += cycles;
+      // going back loads the snapshot from the start of an older frame,
+      // running it again is what puts that frame's picture on screen
+      if (!input.shouldRewind() || !rewind.stepBack(emulator))
+        rewind.capture(emulator);
 
-        if (ppu.hasVBlankInterrupt()) {
-          cpu.requestInterrupt(INT_VBLANK);
-          ppu.clearVBlankInterrupt();
-        }
-        if (ppu.hasStatInterrupt()) {
-          cpu.requestInterrupt(INT_LCD);
-          ppu.clearStatInterrupt();
-        }
-      }
-
-      if (ppu.isFrameReady()) {
-        renderer.render(ppu.getFrameBuffer());
-        ppu.clearFrameReady();
+      bool frameDone = emulator.runFrame();
+      if (frameDone)
         frameCount++;
-      }
 
       auto now = Clock::now();
       auto fpsDelta = std::chrono::duration_cast<std::chrono::milliseconds>(
@@ -200,25 +295,34 @@ int main(int argc, char *argv[]) {
         lastFpsTime = now;
       }
 
-      if (showDebug) {
-        renderer.renderDebug(cpu.getPC(), cpu.getA(), cpu.getF(), cpu.getSP(),
-                             currentFps, cpu.getTotalCycles());
+      // just a copy, the terminal gets it whenever it gets it
+      if (frameDone) {
+        OutputFrame &frame = output.frame();
+        frame.pixels = emulator.framebuffer();
+        frame.debug = showDebug;
+        frame.pc = cpu.getPC();
+        frame.sp = cpu.getSP();
+        frame.a = cpu.getA();
+        frame.f = cpu.getF();
+        frame.fps = currentFps;
+        frame.cycles = cpu.getTotalCycles();
+        output.submit();
       }
 
-      auto frameEnd = Clock::now();
-      auto frameDuration =
-          std::chrono::duration_cast<std::chrono::microseconds>(frameEnd -
-                                                                frameStart);
-      auto targetDuration =
-          std::chrono::microseconds(static_cast<long>(FRAME_TIME_MS * 1000));
+      // audio as the clock: the device eating samples is what lets the
+      // next frame run. otherwise (or with no device) its the wall clock,
+      // and the apu's rate control bends the sound to fit that instead
+      if (audioSync && apu.waitForAudio())
+        continue;
 
-      if (frameDuration < targetDuration) {
-        std::this_thread::sleep_for(targetDuration - frameDuration);
-      }
+      nextFrame += frameTime;
+      if (nextFrame < now - frameTime * 4)
+        nextFrame = now; // way behind (slow host), dont try to catch up
+      std::this_thread::sleep_until(nextFrame);
     }
 
-    cartridge.saveRAM();
-    apu.cleanup();
+    emulator.getCartridge().saveRAM();
+    menu.setAPU(nullptr);
   }
 
   input.disableRawMode();
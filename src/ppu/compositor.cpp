@@ -0,0 +1,98 @@
+#include "ppu/compositor.hpp"
+#include <cstdlib>
+#include <cstring>
+
+#if (defined(__GNUC__) || defined(__clang__)) &&                              \
+    (defined(__x86_64__) || defined(__i386__))
+#define JESTER_COMPOSE_SSSE3 1
+#include <immintrin.h>
+#endif
+
+namespace jester {
+
+using ComposeFn = void (*)(const u8 *, const u8 *, const u8 *, const u8 *,
+                           u8 *);
+
+// bgLut[0..3] = bgp shades, objLut[0..7] = obp0 shades then obp1 shades
+static void composeScalar(const u8 *bg, const u8 *obj, const u8 *bgLut,
+                          const u8 *objLut, u8 *out) {
+  for (u16 x = 0; x < SCREEN_WIDTH; x++) {
+    u8 o = obj[x];
+    bool show = (o & OBJ_COLOR_MASK) && (!(o & OBJ_BEHIND_BG) || !bg[x]);
+    out[x] = show ? objLut[o & 0x07] : bgLut[bg[x]];
+  }
+}
+
+#ifdef JESTER_COMPOSE_SSSE3
+// 16 pixels a go, pshufb does the palette lookups. the screen is exactly
+// 10 of these wide so theres no tail to deal with
+__attribute__((target("ssse3"))) static void
+composeSSSE3(const u8 *bg, const u8 *obj, const u8 *bgLut, const u8 *objLut,
+             u8 *out) {
+  static_assert(SCREEN_WIDTH % 16 == 0, "compositor wants 16 pixel chunks");
+
+  const __m128i bgTable = _mm_setr_epi8(bgLut[0], bgLut[1], bgLut[2],
+                                        bgLut[3], 0, 0, 0, 0, 0, 0, 0, 0, 0,
+                                        0, 0, 0);
+  const __m128i objTable = _mm_setr_epi8(
+      objLut[0], objLut[1], objLut[2], objLut[3], objLut[4], objLut[5],
+      objLut[6], objLut[7], 0, 0, 0, 0, 0, 0, 0, 0);
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i lutMask = _mm_set1_epi8(0x07);
+  const __m128i colorMask = _mm_set1_epi8(OBJ_COLOR_MASK);
+  const __m128i behindMask = _mm_set1_epi8(OBJ_BEHIND_BG);
+
+  for (u16 x = 0; x < SCREEN_WIDTH; x += 16) {
+    __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(bg + x));
+    __m128i o = _mm_loadu_si128(reinterpret_cast<const __m128i *>(obj + x));
+
+    __m128i bgShade = _mm_shuffle_epi8(bgTable, b);
+    __m128i objShade = _mm_shuffle_epi8(objTable, _mm_and_si128(o, lutMask));
+
+    // hidden = transparent, or behind bg and the bg isnt color 0
+    __m128i clear = _mm_cmpeq_epi8(_mm_and_si128(o, colorMask), zero);
+    __m128i behind = _mm_cmpeq_epi8(_mm_and_si128(o, behindMask), behindMask);
+    __m128i bgSolid = _mm_xor_si128(_mm_cmpeq_epi8(b, zero),
+                                    _mm_cmpeq_epi8(zero, zero));
+    __m128i hidden = _mm_or_si128(clear, _mm_and_si128(behind, bgSolid));
+
+    __m128i shade = _mm_or_si128(_mm_and_si128(hidden, bgShade),
+                                 _mm_andnot_si128(hidden, objShade));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(out + x), shade);
+  }
+}
+#endif
+
+static ComposeFn pickCompositor(const char **name) {
+#ifdef JESTER_COMPOSE_SSSE3
+  // JESTER_COMPOSITOR=scalar forces the plain one, so both can be checked
+  // against each other with --hash on the same machine
+  const char *force = std::getenv("JESTER_COMPOSITOR");
+  bool scalar = force && std::strcmp(force, "scalar") == 0;
+  __builtin_cpu_init(); // we run from a static initializer
+  if (!scalar && __builtin_cpu_supports("ssse3")) {
+    *name = "ssse3";
+    return composeSSSE3;
+  }
+#endif
+  *name = "scalar";
+  return composeScalar;
+}
+
+static const char *selectedName = nullptr;
+static const ComposeFn selected = pickCompositor(&selectedName);
+
+void composeScanline(const u8 *bg, const u8 *obj, u8 bgp, u8 obp0, u8 obp1,
+                     u8 *out) {
+  u8 bgLut[4], objLut[8];
+  for (u8 c = 0; c < 4; c++) {
+    bgLut[c] = (bgp >> (c * 2)) & 0x03;
+    objLut[c] = (obp0 >> (c * 2)) & 0x03;
+    objLut[c + 4] = (obp1 >> (c * 2)) & 0x03;
+  }
+  selected(bg, obj, bgLut, objLut, out);
+}
+
+const char *compositorName() { return selectedName; }
+
+} // namespace jester
@@ -0,0 +1,21 @@
+#pragma once
+
+#include "types.hpp"
+
+namespace jester {
+
+// sprite layer pixel bits. 0 means no sprite pixel there
+constexpr u8 OBJ_COLOR_MASK = 0x03; // raw color number, 0 = transparent
+constexpr u8 OBJ_PALETTE1 = 0x04;   // use obp1 instead of obp0
+constexpr u8 OBJ_BEHIND_BG = 0x08;  // hide behind bg colors 1-3
+
+// squash one line of raw bg/window color numbers and sprite pixels into
+// final shades. palettes get applied here and nowhere else, so bg priority
+// is decided on raw color numbers like the real thing does it.
+// picks ssse3 when the cpu has it (and JESTER_COMPOSITOR isnt "scalar"),
+// plain c++ otherwise
+void composeScanline(const u8 *bg, const u8 *obj, u8 bgp, u8 obp0, u8 obp1,
+                     u8 *out);
+const char *compositorName(); // "ssse3" or "scalar", headless prints it
+
+} // namespace jester
@@ -1,4 +1,9 @@
 #include "ppu/ppu.hpp"
+#include "bus/bus.hpp"
+#include "ppu/compositor.hpp"
+#include "scheduler/scheduler.hpp"
+#include "state/state.hpp"
+#include <cstring>
 
 namespace jester {
 
@@ -6,6 +11,9 @@ PPU::PPU() { reset(); }
 
 void PPU::reset() {
   vram.fill(0);
+  tileDirty.fill(true);
+  lineValid.fill(false);
+  dirtyLines.fill(true);
   oam.fill(0);
   frameBuffer.fill(0);
 
@@ -22,73 +30,120 @@ void PPU::reset() {
   wy = 0;
   wx = 0;
 
-  modeClock = 0;
+  modeStart = scheduler ? scheduler->now() : 0;
   mode = MODE_OAM;
   frameReady = false;
   windowLine = 0;
 
-  vblankInterrupt = false;
-  statInterrupt = false;
+  scheduleNext();
 }
 
-void PPU::step(u32 cycles) {
-  // screen is off lol (lcd disabled)
+void PPU::attachScheduler(Scheduler *sched) {
+  scheduler = sched;
+  if (scheduler) {
+    scheduler->setHandler(Event::PPU, &PPU::onEvent, this);
+    modeStart = scheduler->now();
+    scheduleNext();
+  }
+}
+
+void PPU::onEvent(void *ctx, u64 when) {
+  static_cast<PPU *>(ctx)->handleEvent(when);
+}
+
+void PPU::scheduleNext() {
+  if (!scheduler)
+    return;
+
+  // screen is off lol (lcd disabled), nothing to wake up for
   if (!(lcdc & 0x80)) {
+    scheduler->cancel(Event::PPU);
     return;
   }
 
-  modeClock += cycles;
-
+  u32 length = CYCLES_LINE;
   switch (mode) {
-  case MODE_OAM: // searchin oam for sprites
-    if (modeClock >= CYCLES_OAM) {
-      modeClock -= CYCLES_OAM;
-      setMode(MODE_VRAM);
-    }
+  case MODE_OAM:
+    length = CYCLES_OAM;
+    break;
+  case MODE_VRAM:
+    length = CYCLES_VRAM;
+    break;
+  case MODE_HBLANK:
+    length = CYCLES_HBLANK;
     break;
+  }
+  scheduler->schedule(Event::PPU, modeStart + length);
+}
 
-  case MODE_VRAM: // reading vram data shit
-    if (modeClock >= CYCLES_VRAM) {
-      modeClock -= CYCLES_VRAM;
+void PPU::requestInterrupt(u8 interrupt) {
+  if (bus)
+    bus->requestInterrupt(interrupt);
+}
 
-      // render the actual line
-      renderScanline();
+void PPU::handleEvent(u64 when) {
+  switch (mode) {
+  case MODE_OAM: // done searchin oam for sprites
+    setMode(MODE_VRAM);
+    break;
 
-      setMode(MODE_HBLANK);
-    }
+  case MODE_VRAM: // done reading vram, render the actual line
+    if (ly == 0)
+      startFrame();
+    if (renderFrame)
+      renderScanline();
+    else if (windowVisible(ly))
+      windowLine++; // still saved in states, keep it honest
+    setMode(MODE_HBLANK);
     break;
 
-  case MODE_HBLANK: // h-blank chill time
-    if (modeClock >= CYCLES_HBLANK) {
-      modeClock -= CYCLES_HBLANK;
-      ly++;
-      checkLYC();
-
-      if (ly >= LINES_VISIBLE) {
-        // vblank time baby
-        setMode(MODE_VBLANK);
-        frameReady = true;
-        vblankInterrupt = true;
-      } else {
-        setMode(MODE_OAM);
-      }
+  case MODE_HBLANK: // h-blank chill time is over
+    ly++;
+    checkLYC();
+
+    if (ly >= LINES_VISIBLE) {
+      // vblank time baby
+      setMode(MODE_VBLANK);
+      frameReady = renderFrame;
+      requestInterrupt(INT_VBLANK);
+    } else {
+      setMode(MODE_OAM);
     }
     break;
 
-  case MODE_VBLANK: // v-blank chill time
-    if (modeClock >= CYCLES_LINE) {
-      modeClock -= CYCLES_LINE;
-      ly++;
+  case MODE_VBLANK: // one more v-blank line down
+    ly++;
 
-      if (ly >= LINES_TOTAL) {
-        ly = 0;
-        windowLine = 0;
-        setMode(MODE_OAM);
-      }
-      checkLYC();
+    if (ly >= LINES_TOTAL) {
+      ly = 0;
+      windowLine = 0;
+      setMode(MODE_OAM);
     }
+    checkLYC();
     break;
   }
+
+  // next deadline counts from when this one was due, not from when the
+  // cpu got around to us, so late dispatch never drifts the frame
+  modeStart = when;
+  scheduleNext();
+}
+
+// called as line 0 gets drawn, late enough that a requestFrame() made
+// right before running the frame still counts. nothing a skipped frame
+// leaves behind matters to the next one: the window line counter restarts
+// at 0 and the tile cache tracks vram by itself
+void PPU::startFrame() {
+  if (frameSkip == 0) {
+    renderFrame = frameRequested;
+    frameRequested = false;
+  } else {
+    renderFrame = ++framesSkipped >= frameSkip;
+    if (renderFrame)
+      framesSkipped = 0;
+  }
+  if (renderFrame)
+    dirtyLines.fill(false);
 }
 
 void PPU::setMode(u8 newMode) {
@@ -105,7 +160,7 @@ void PPU::setMode(u8 newMode) {
     interrupt = true;
 
   if (interrupt) {
-    statInterrupt = true;
+    requestInterrupt(INT_LCD);
   }
 }
 
@@ -113,131 +168,154 @@ void PPU::checkLYC() {
   if (ly == lyc) {
     stat |= 0x04; // found a match (coincidence flag)
     if (stat & 0x40) {
-      statInterrupt = true;
+      requestInterrupt(INT_LCD);
     }
   } else {
     stat &= ~0x04;
   }
 }
 
+bool PPU::LineInputs::operator==(const LineInputs &o) const {
+  return lcdc == o.lcdc && scx == o.scx && scy == o.scy && wx == o.wx &&
+         wy == o.wy && bgp == o.bgp && obp0 == o.obp0 && obp1 == o.obp1 &&
+         windowLine == o.windowLine && tileGen == o.tileGen &&
+         bgMapGen == o.bgMapGen && windowMapGen == o.windowMapGen &&
+         spriteGen == o.spriteGen;
+}
+
+PPU::LineInputs PPU::currentInputs() const {
+  LineInputs in;
+  in.lcdc = lcdc;
+  in.scx = scx;
+  in.scy = scy;
+  in.wx = wx;
+  in.wy = wy;
+  // lcdc bit 0 off = bg (and window) all shade 0 no matter what bgp says.
+  // the palette that really gets used is part of the key
+  in.bgp = (lcdc & 0x01) ? bgp : 0;
+  in.obp0 = obp0;
+  in.obp1 = obp1;
+  in.windowLine = windowLine;
+  in.tileGen = tileDataGen;
+  in.bgMapGen = mapRowGen[(lcdc & 0x08 ? 32 : 0) + (u8(ly + scy) / 8)];
+  in.windowMapGen = mapRowGen[(lcdc & 0x40 ? 32 : 0) + (windowLine / 8)];
+  in.spriteGen = spriteGen[ly];
+  return in;
+}
+
+// each layer goes into its own line of raw color numbers, the compositor
+// sorts out priority and palettes for all of them in one go
 void PPU::renderScanline() {
   if (ly >= SCREEN_HEIGHT)
     return;
 
-  // clear the line junk
-  for (u16 x = 0; x < SCREEN_WIDTH; x++) {
-    frameBuffer[ly * SCREEN_WIDTH + x] = 0;
+  // same inputs as last time this line got drawn = same pixels
+  LineInputs inputs = currentInputs();
+  bool window = windowVisible(ly);
+  if (lineValid[ly] && lineInputs[ly] == inputs) {
+    if (window)
+      windowLine++;
+    return;
   }
+  lineInputs[ly] = inputs;
+  lineValid[ly] = true;
+
+  u8 bgLine[SCREEN_WIDTH];
+  u8 objLine[SCREEN_WIDTH];
 
-  // draw the layers
   if (lcdc & 0x01) { // bg is on
-    renderBackground(ly);
+    renderBackground(ly, bgLine);
+  } else {
+    std::memset(bgLine, 0, sizeof(bgLine));
   }
 
-  if ((lcdc & 0x20) && (ly >= wy)) { // window is on and visible
-    renderWindow(ly);
+  if (window && (lcdc & 0x01)) {
+    renderWindow(bgLine);
+  } else if (window) {
+    windowLine++; // blanked with the bg, but still counting
   }
 
+  std::memset(objLine, 0, sizeof(objLine));
   if (lcdc & 0x02) { // sprites are on
-    renderSprites(ly);
+    renderSprites(ly, objLine);
   }
-}
 
-void PPU::renderBackground(u8 scanline) {
-  // Tile map base
-  u16 tileMapBase = (lcdc & 0x08) ? 0x1C00 : 0x1800;
-  // Tile data base
-  bool signedAddr = !(lcdc & 0x10);
-  u16 tileDataBase = signedAddr ? 0x0800 : 0x0000;
+  // inputs moving doesnt always move pixels (a sprite sliding around
+  // under the bg, say), only flag the line if it really changed
+  u8 shades[SCREEN_WIDTH];
+  composeScanline(bgLine, objLine, inputs.bgp, obp0, obp1, shades);
+  u8 *dst = &frameBuffer[ly * SCREEN_WIDTH];
+  if (std::memcmp(dst, shades, SCREEN_WIDTH) != 0) {
+    std::memcpy(dst, shades, SCREEN_WIDTH);
+    dirtyLines[ly] = true;
+  }
+}
 
-  u8 y = scanline + scy;
-  u8 tileRow = y / 8;
-  u8 pixelY = y % 8;
-
-  for (u16 x = 0; x < SCREEN_WIDTH; x++) {
-    u8 scrolledX = x + scx;
-    u8 tileCol = scrolledX / 8;
-    u8 pixelX = scrolledX % 8;
-
-    // Get tile index
-    u16 tileMapAddr = tileMapBase + (tileRow * 32) + tileCol;
-    u8 tileIndex = vram[tileMapAddr];
-
-    // Get tile data address
-    u16 tileAddr;
-    if (signedAddr) {
-      s8 signedIndex = static_cast<s8>(tileIndex);
-      tileAddr = tileDataBase + ((signedIndex + 128) * 16);
-    } else {
-      tileAddr = tileDataBase + (tileIndex * 16);
+const u8 *PPU::tileRow(u16 tile, u8 row) {
+  if (tileDirty[tile]) {
+    for (u8 y = 0; y < 8; y++) {
+      u8 lo = vram[tile * 16 + y * 2];
+      u8 hi = vram[tile * 16 + y * 2 + 1];
+      u8 *out = tileRows[tile * 8 + y].data();
+      for (u8 x = 0; x < 8; x++) {
+        u8 bit = 7 - x;
+        out[x] = ((hi >> bit) & 1) << 1 | ((lo >> bit) & 1);
+      }
     }
+    tileDirty[tile] = false;
+  }
+  return tileRows[tile * 8 + row].data();
+}
 
-    // Get pixel color from tile
-    u16 rowAddr = tileAddr + (pixelY * 2);
-    u8 lo = vram[rowAddr];
-    u8 hi = vram[rowAddr + 1];
-
-    u8 bit = 7 - pixelX;
-    u8 colorNum = ((hi >> bit) & 1) << 1 | ((lo >> bit) & 1);
-    u8 color = getColorFromPalette(colorNum, bgp);
+// map entry -> tile number in the cache. lcdc bit 4 off means the index is
+// signed and counts from 0x9000, which is tiles 256 + index
+u16 PPU::bgTile(u16 tileMapAddr) const {
+  u8 tileIndex = vram[tileMapAddr];
+  if (!(lcdc & 0x10))
+    return 256 + static_cast<s8>(tileIndex);
+  return tileIndex;
+}
 
-    frameBuffer[scanline * SCREEN_WIDTH + x] = color;
+// 21 tile rows back to back (168 pixels, enough for any fine scroll),
+// starting at tileCol and wrapping around the 32 wide map
+void PPU::fetchTileLine(u16 tileMapBase, u8 tileRowIndex, u8 tileCol,
+                        u8 pixelY, u8 *out) {
+  u16 rowBase = tileMapBase + tileRowIndex * 32;
+  for (u8 i = 0; i < 21; i++) {
+    u16 tile = bgTile(rowBase + ((tileCol + i) & 31));
+    std::memcpy(out + i * 8, tileRow(tile, pixelY), 8);
   }
 }
 
-void PPU::renderWindow(u8 scanline) {
-  if (wx > 166 || wy > scanline)
-    return;
+void PPU::renderBackground(u8 scanline, u8 *line) {
+  u16 tileMapBase = (lcdc & 0x08) ? 0x1C00 : 0x1800;
 
-  // Tile map base for window
-  u16 tileMapBase = (lcdc & 0x40) ? 0x1C00 : 0x1800;
-  bool signedAddr = !(lcdc & 0x10);
-  u16 tileDataBase = signedAddr ? 0x0800 : 0x0000;
+  u8 y = scanline + scy;
+  u8 tiles[21 * 8];
+  fetchTileLine(tileMapBase, y / 8, scx / 8, y % 8, tiles);
+  std::memcpy(line, tiles + (scx % 8), SCREEN_WIDTH);
+}
 
-  u8 y = windowLine;
-  u8 tileRow = y / 8;
-  u8 pixelY = y % 8;
+// window is on and somewhere on this line
+bool PPU::windowVisible(u8 scanline) const {
+  return (lcdc & 0x20) && scanline >= wy && wx <= 166;
+}
 
+void PPU::renderWindow(u8 *line) {
+  // window x can start off the left edge (wx < 7)
   s16 windowX = wx - 7;
-  bool drewWindow = false;
+  u16 startX = windowX < 0 ? 0 : windowX;
 
-  for (u16 x = 0; x < SCREEN_WIDTH; x++) {
-    if (static_cast<s16>(x) < windowX)
-      continue;
-    drewWindow = true;
-
-    u8 windowPixelX = x - windowX;
-    u8 tileCol = windowPixelX / 8;
-    u8 pixelX = windowPixelX % 8;
-
-    u16 tileMapAddr = tileMapBase + (tileRow * 32) + tileCol;
-    u8 tileIndex = vram[tileMapAddr];
-
-    u16 tileAddr;
-    if (signedAddr) {
-      s8 signedIndex = static_cast<s8>(tileIndex);
-      tileAddr = tileDataBase + ((signedIndex + 128) * 16);
-    } else {
-      tileAddr = tileDataBase + (tileIndex * 16);
-    }
-
-    u16 rowAddr = tileAddr + (pixelY * 2);
-    u8 lo = vram[rowAddr];
-    u8 hi = vram[rowAddr + 1];
-
-    u8 bit = 7 - pixelX;
-    u8 colorNum = ((hi >> bit) & 1) << 1 | ((lo >> bit) & 1);
-    u8 color = getColorFromPalette(colorNum, bgp);
-
-    frameBuffer[scanline * SCREEN_WIDTH + x] = color;
-  }
+  u16 tileMapBase = (lcdc & 0x40) ? 0x1C00 : 0x1800;
+  u8 tiles[21 * 8];
+  fetchTileLine(tileMapBase, windowLine / 8, 0, windowLine % 8, tiles);
+  std::memcpy(line + startX, tiles + (startX - windowX),
+              SCREEN_WIDTH - startX);
 
-  if (drewWindow) {
-    windowLine++;
-  }
+  windowLine++;
 }
 
-void PPU::renderSprites(u8 scanline) {
+void PPU::renderSprites(u8 scanline, u8 *line) {
   u8 spriteHeight = (lcdc & 0x04) ? 16 : 8; // big or small bois?
 
   // find sprites for this line (max 10 allowed by hardware)
@@ -282,8 +360,11 @@ void PPU::renderSprites(u8 scanline) {
 
     bool flipX = spr.flags & 0x20;
     bool flipY = spr.flags & 0x40;
-    bool priority = spr.flags & 0x80; // 0=above BG, 1=behind BG colors 1-3
-    u8 palette = (spr.flags & 0x10) ? obp1 : obp0;
+    u8 attrs = 0;
+    if (spr.flags & 0x80) // 0=above BG, 1=behind BG colors 1-3
+      attrs |= OBJ_BEHIND_BG;
+    if (spr.flags & 0x10)
+      attrs |= OBJ_PALETTE1;
 
     u8 tileY = scanline - spr.y;
     if (flipY) {
@@ -299,37 +380,25 @@ void PPU::renderSprites(u8 scanline) {
       }
     }
 
-    u16 tileAddr = tileIndex * 16 + tileY * 2;
-    u8 lo = vram[tileAddr];
-    u8 hi = vram[tileAddr + 1];
+    const u8 *row = tileRow(tileIndex, tileY);
 
     for (u8 px = 0; px < 8; px++) {
       s16 screenX = spr.x + px;
       if (screenX < 0 || screenX >= SCREEN_WIDTH)
         continue;
 
-      u8 bit = flipX ? px : (7 - px);
-      u8 colorNum = ((hi >> bit) & 1) << 1 | ((lo >> bit) & 1);
+      u8 colorNum = row[flipX ? 7 - px : px];
 
       // color 0 is invisible for sprites (obv)
       if (colorNum == 0)
         continue;
 
-      // Check priority
-      if (priority && frameBuffer[scanline * SCREEN_WIDTH + screenX] != 0) {
-        continue;
-      }
-
-      u8 color = getColorFromPalette(colorNum, palette);
-      frameBuffer[scanline * SCREEN_WIDTH + screenX] = color;
+      // bg priority gets settled in composeScanline against the raw bg
+      line[screenX] = colorNum | attrs;
     }
   }
 }
 
-u8 PPU::getColorFromPalette(u8 colorNum, u8 palette) const {
-  return (palette >> (colorNum * 2)) & 0x03;
-}
-
 u8 PPU::readVRAM(u16 addr) const {
   if (addr < vram.size()) {
     return vram[addr];
@@ -338,9 +407,16 @@ u8 PPU::readVRAM(u16 addr) const {
 }
 
 void PPU::writeVRAM(u16 addr, u8 val) {
-  if (addr < vram.size()) {
-    vram[addr] = val;
+  if (addr >= vram.size() || vram[addr] == val)
+    return;
+
+  if (addr < TILE_DATA_SIZE) {
+    tileDirty[addr / 16] = true;
+    tileDataGen++;
+  } else {
+    mapRowGen[(addr - TILE_DATA_SIZE) / 32]++;
   }
+  vram[addr] = val;
 }
 
 u8 PPU::readOAM(u16 addr) const {
@@ -350,12 +426,26 @@ u8 PPU::readOAM(u16 addr) const {
   return 0xFF;
 }
 
-void PPU::writeOAM(u16 addr, u8 val) {
-  if (addr < oam.size()) {
-    oam[addr] = val;
+// every line the sprite could cover, as a 8x16 to not care about lcdc
+void PPU::touchSprite(u8 index) {
+  u8 top = oam[index * 4] - 16;
+  for (u8 row = 0; row < 16; row++) {
+    u8 line = top + row;
+    if (line < SCREEN_HEIGHT)
+      spriteGen[line]++;
   }
 }
 
+void PPU::writeOAM(u16 addr, u8 val) {
+  if (addr >= oam.size() || oam[addr] == val)
+    return;
+
+  // old spot and new spot both need a redraw
+  touchSprite(addr / 4);
+  oam[addr] = val;
+  touchSprite(addr / 4);
+}
+
 u8 PPU::readRegister(u16 addr) const {
   switch (addr) {
   case LCDC:
@@ -391,10 +481,15 @@ void PPU::writeRegister(u16 addr, u8 val) {
     // Turning LCD off resets LY
     if ((lcdc & 0x80) && !(val & 0x80)) {
       ly = 0;
-      modeClock = 0;
       mode = MODE_HBLANK;
       stat = (stat & 0xFC) | mode;
     }
+    // turning it back on starts the clock again from here
+    if ((lcdc & 0x80) != (val & 0x80)) {
+      lcdc = val;
+      modeStart = scheduler ? scheduler->now() : 0;
+      scheduleNext();
+    }
     lcdc = val;
     break;
   case STAT:
@@ -428,4 +523,47 @@ void PPU::writeRegister(u16 addr, u8 val) {
   }
 }
 
+// the framebuffer isnt saved, the next frame redraws it anyway
+void PPU::serialize(Writer &w) const {
+  w.writeBytes(vram.data(), vram.size());
+  w.writeBytes(oam.data(), oam.size());
+  w.write8(lcdc);
+  w.write8(stat);
+  w.write8(scy);
+  w.write8(scx);
+  w.write8(ly);
+  w.write8(lyc);
+  w.write8(bgp);
+  w.write8(obp0);
+  w.write8(obp1);
+  w.write8(wy);
+  w.write8(wx);
+  w.write8(windowLine);
+  w.write8(mode);
+  w.write64(modeStart);
+  w.writeBool(frameReady);
+}
+
+void PPU::deserialize(Reader &r) {
+  r.readBytes(vram.data(), vram.size());
+  tileDirty.fill(true);
+  lineValid.fill(false);
+  r.readBytes(oam.data(), oam.size());
+  lcdc = r.read8();
+  stat = r.read8();
+  scy = r.read8();
+  scx = r.read8();
+  ly = r.read8();
+  lyc = r.read8();
+  bgp = r.read8();
+  obp0 = r.read8();
+  obp1 = r.read8();
+  wy = r.read8();
+  wx = r.read8();
+  windowLine = r.read8();
+  mode = r.read8();
+  modeStart = r.read64();
+  frameReady = r.readBool();
+}
+
 } // namespace jester
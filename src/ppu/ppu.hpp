@@ -5,12 +5,18 @@
 
 namespace jester {
 
+class Bus;
+class Reader;
+class Scheduler;
+class Writer;
+
 class PPU {
 public:
   PPU();
 
   void reset();
-  void step(u32 cycles);
+  void attachBus(Bus *b) { bus = b; }
+  void attachScheduler(Scheduler *sched);
 
   u8 readVRAM(u16 addr) const;
   void writeVRAM(u16 addr, u8 val);
@@ -19,32 +25,77 @@ public:
   u8 readRegister(u16 addr) const;
   void writeRegister(u16 addr, u8 val);
 
+  // bus maps this straight in for reads only. writes have to come through
+  // writeVRAM so the tile cache and the line tracking hear about them
+  const u8 *getVRAM() const { return vram.data(); }
+
+  // skip the pixel work on some frames. ly/stat/interrupts keep the exact
+  // same timing, the framebuffer just keeps the last picture it had.
+  // n = draw every nth frame (1 = all of them), 0 = only after requestFrame,
+  // which gets the next frame that hasnt started drawing yet
+  void setFrameSkip(u8 n) { frameSkip = n; }
+  void requestFrame() { frameRequested = true; }
+
+  // only set for frames that actually got drawn
   bool isFrameReady() const { return frameReady; }
   void clearFrameReady() { frameReady = false; }
   const std::array<u8, 160 * 144> &getFrameBuffer() const {
     return frameBuffer;
   }
+  // which lines of the last drawn frame differ from the drawn frame before
+  // it. lines whose inputs didnt change arent even redrawn
+  const std::array<bool, 144> &getDirtyLines() const { return dirtyLines; }
 
-  bool hasVBlankInterrupt() const { return vblankInterrupt; }
-  void clearVBlankInterrupt() { vblankInterrupt = false; }
-  bool hasStatInterrupt() const { return statInterrupt; }
-  void clearStatInterrupt() { statInterrupt = false; }
+  // save states (see state/state.hpp)
+  void serialize(Writer &w) const;
+  void deserialize(Reader &r);
 
 private:
+  Bus *bus = nullptr;
+  Scheduler *scheduler = nullptr;
+
   std::array<u8, 0x2000> vram;
   std::array<u8, 160> oam;
   std::array<u8, 160 * 144> frameBuffer;
 
+  // every tile row already split into 8 color numbers (0-3), left to right.
+  // rebuilt lazily, writeVRAM just marks the tile dirty
+  static constexpr u16 TILE_COUNT = 384;
+  std::array<std::array<u8, 8>, TILE_COUNT * 8> tileRows;
+  std::array<bool, TILE_COUNT> tileDirty;
+
+  // everything a line's pixels depend on. generations get bumped when the
+  // memory behind them actually changes: any tile data byte, one 32 tile
+  // row of a map, or any oam entry that covers the line (before or after).
+  // tile data is one counter for all of it, it rarely moves on static
+  // screens and tracking it per tile costs about as much as drawing
+  struct LineInputs {
+    u8 lcdc, scx, scy, wx, wy, bgp, obp0, obp1, windowLine;
+    u32 tileGen, bgMapGen, windowMapGen, spriteGen;
+    bool operator==(const LineInputs &o) const;
+  };
+  static constexpr u16 TILE_DATA_SIZE = 0x1800;
+  u32 tileDataGen = 0;
+  std::array<u32, 64> mapRowGen{}; // 32 rows per map, both maps
+  std::array<u32, 144> spriteGen{};
+  std::array<LineInputs, 144> lineInputs;
+  std::array<bool, 144> lineValid; // false = redraw no matter what
+  std::array<bool, 144> dirtyLines;
+
   u8 lcdc = 0x91, stat = 0, scy = 0, scx = 0;
   u8 ly = 0, lyc = 0, bgp = 0xFC, obp0 = 0, obp1 = 0;
   u8 wy = 0, wx = 0;
   u8 windowLine = 0;
   u8 mode = 0;
 
-  u32 modeClock = 0;
+  u64 modeStart = 0; // cycle the current mode (or vblank line) began
   bool frameReady = false;
-  bool vblankInterrupt = false;
-  bool statInterrupt = false;
+
+  // host side knobs, not part of save states
+  u8 frameSkip = 1;
+  u8 framesSkipped = 0;
+  bool frameRequested = false;
+  bool renderFrame = true; // decided once per frame, at line 0
 
   static constexpr u8 MODE_HBLANK = 0;
   static constexpr u8 MODE_VBLANK = 1;
@@ -60,13 +111,24 @@ private:
   static constexpr u32 CYCLES_HBLANK = 204;
   static constexpr u32 CYCLES_LINE = 456;
 
+  static void onEvent(void *ctx, u64 when);
+  void handleEvent(u64 when);
+  void scheduleNext();
+  void requestInterrupt(u8 interrupt);
   void setMode(u8 newMode);
   void checkLYC();
+  void startFrame();
   void renderScanline();
-  void renderBackground(u8 scanline);
-  void renderWindow(u8 scanline);
-  void renderSprites(u8 scanline);
-  u8 getColorFromPalette(u8 colorNum, u8 palette) const;
+  LineInputs currentInputs() const;
+  void touchSprite(u8 index);
+  const u8 *tileRow(u16 tile, u8 row);
+  u16 bgTile(u16 tileMapAddr) const;
+  void fetchTileLine(u16 tileMapBase, u8 tileRowIndex, u8 tileCol, u8 pixelY,
+                     u8 *out);
+  void renderBackground(u8 scanline, u8 *line);
+  bool windowVisible(u8 scanline) const;
+  void renderWindow(u8 *line); // only when windowVisible
+  void renderSprites(u8 scanline, u8 *line);
 };
 
 } // namespace jester
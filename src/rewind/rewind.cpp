@@ -0,0 +1,198 @@
+#include "rewind/rewind.hpp"
+#include "emulator/emulator.hpp"
+#include <algorithm>
+#include <cstring>
+
+namespace jester {
+
+// rle token: u16 run of unchanged bytes, u16 literal count, literals.
+// a literal only gets cut when at least this many zeros show up, shorter
+// gaps are cheaper to just copy
+static constexpr size_t MIN_ZERO_RUN = 4;
+static constexpr size_t MAX_RUN = 0xFFFF;
+
+Rewind::Rewind(size_t stateSize, u32 seconds, size_t budget)
+    : stateSize(stateSize), arenaSize(budget), arena(new u8[budget]),
+      entries(std::max<u32>(seconds * 60, 1)), current(stateSize),
+      reference(stateSize),
+      // worst case: every token header is paid for by a zero run except
+      // the first one and the ones after a maxed out literal
+      scratch(stateSize + (stateSize / MAX_RUN + 2) * 4) {}
+
+void Rewind::clear() {
+  first = 0;
+  count = 0;
+  writePos = 0;
+  sinceKeyframe = 0;
+  hasReference = false;
+}
+
+size_t Rewind::memoryUsed() const {
+  size_t used = 0;
+  for (u32 i = 0; i < count; i++) {
+    used += entries[(first + i) % entries.size()].size;
+  }
+  return used;
+}
+
+// deltas are useless without their keyframe, so they go with it
+void Rewind::evictOldest() {
+  do {
+    first = (first + 1) % entries.size();
+    count--;
+  } while (count && !at(0).keyframe);
+}
+
+// carve out room at the write head, throwing away the oldest snapshots
+// until they dont overlap it anymore
+u8 *Rewind::reserve(size_t size) {
+  if (size > arenaSize)
+    return nullptr;
+
+  size_t pos = writePos;
+  if (pos + size > arenaSize) {
+    // wrap. everything past the head is older than everything before it
+    while (count && at(0).offset >= pos)
+      evictOldest();
+    pos = 0;
+  }
+  while (count && at(0).offset < pos + size &&
+         pos < at(0).offset + at(0).size)
+    evictOldest();
+
+  writePos = pos + size;
+  return arena.get() + pos;
+}
+
+size_t Rewind::encode(const u8 *state, const u8 *ref) {
+  auto changed = [&](size_t i) { return ref ? state[i] ^ ref[i] : state[i]; };
+
+  u8 *out = scratch.data();
+  size_t len = 0;
+  size_t i = 0;
+  while (i < stateSize) {
+    size_t zeros = 0;
+    while (i < stateSize && zeros < MAX_RUN && !changed(i)) {
+      zeros++;
+      i++;
+    }
+
+    size_t start = i;
+    size_t literals = 0;
+    while (i < stateSize && literals < MAX_RUN) {
+      if (!changed(i)) {
+        // peek ahead, only stop for a run thats worth a new token
+        size_t run = 0;
+        while (i + run < stateSize && run < MIN_ZERO_RUN && !changed(i + run))
+          run++;
+        if (run == MIN_ZERO_RUN || i + run == stateSize)
+          break;
+      }
+      literals++;
+      i++;
+    }
+
+    out[len++] = zeros & 0xFF;
+    out[len++] = zeros >> 8;
+    out[len++] = literals & 0xFF;
+    out[len++] = literals >> 8;
+    for (size_t j = 0; j < literals; j++) {
+      out[len++] = changed(start + j);
+    }
+  }
+  return len;
+}
+
+void Rewind::decode(const Entry &entry, const u8 *ref, u8 *out) const {
+  if (ref)
+    std::memcpy(out, ref, stateSize);
+  else
+    std::memset(out, 0, stateSize);
+
+  const u8 *in = arena.get() + entry.offset;
+  const u8 *end = in + entry.size;
+  size_t i = 0;
+  while (in + 4 <= end) {
+    size_t zeros = in[0] | (in[1] << 8);
+    size_t literals = in[2] | (in[3] << 8);
+    in += 4;
+    i += zeros;
+    for (size_t j = 0; j < literals && i < stateSize; j++) {
+      out[i++] ^= *in++;
+    }
+  }
+}
+
+void Rewind::capture(const Emulator &emulator) {
+  if (emulator.saveState(current.data(), stateSize) != stateSize)
+    return;
+
+  if (count == entries.size())
+    evictOldest();
+
+  bool keyframe = sinceKeyframe >= KEYFRAME_INTERVAL || !referenceLive();
+  size_t size = encode(current.data(), keyframe ? nullptr : reference.data());
+  if (!keyframe && size > stateSize / 2) {
+    // so much changed a fresh keyframe is about as cheap
+    keyframe = true;
+    size = encode(current.data(), nullptr);
+  }
+
+  u8 *dst = reserve(size);
+  if (dst && !keyframe && !referenceLive()) {
+    // making room just ate our keyframe, this has to become one
+    keyframe = true;
+    size = encode(current.data(), nullptr);
+    dst = reserve(size);
+  }
+  if (!dst)
+    return;
+
+  std::memcpy(dst, scratch.data(), size);
+  Entry &entry = at(count);
+  entry.offset = dst - arena.get();
+  entry.size = static_cast<u32>(size);
+  entry.keyframe = keyframe;
+  count++;
+
+  if (keyframe) {
+    std::memcpy(reference.data(), current.data(), stateSize);
+    hasReference = true;
+    referenceEntry = pushed;
+    sinceKeyframe = 0;
+  }
+  pushed++;
+  sinceKeyframe++;
+}
+
+bool Rewind::stepBack(Emulator &emulator) {
+  if (!count)
+    return false;
+
+  Entry entry = at(count - 1);
+  if (entry.keyframe) {
+    decode(entry, nullptr, current.data());
+    hasReference = false;
+    sinceKeyframe = KEYFRAME_INTERVAL; // next capture starts a new one
+  } else {
+    // the oldest entry is always a keyframe so this cant run off the end
+    u32 key = count - 1;
+    while (!at(key).keyframe)
+      key--;
+    u64 keyEntry = pushed - count + key;
+    if (!hasReference || referenceEntry != keyEntry) {
+      decode(at(key), nullptr, reference.data());
+      hasReference = true;
+      referenceEntry = keyEntry;
+    }
+    decode(entry, reference.data(), current.data());
+    sinceKeyframe = count - 1 - key;
+  }
+
+  count--;
+  pushed--;
+  writePos = entry.offset;
+  return emulator.loadState(current.data(), stateSize);
+}
+
+} // namespace jester
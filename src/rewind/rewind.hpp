@@ -0,0 +1,66 @@
+#pragma once
+
+#include "types.hpp"
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+namespace jester {
+
+class Emulator;
+
+// the last few seconds of save states, one per frame, in a fixed arena.
+// every so often a keyframe goes in (rle'd on its own), everything in
+// between is the xor against that keyframe, rle'd. most of ram doesnt
+// change frame to frame so those deltas are tiny.
+// all memory is grabbed up front, capture never allocates
+class Rewind {
+public:
+  // stateSize from Emulator::stateSize(), budget is the arena in bytes
+  Rewind(size_t stateSize, u32 seconds, size_t budget);
+
+  void capture(const Emulator &emulator); // call once per frame
+  bool stepBack(Emulator &emulator);      // load + drop the newest snapshot
+  void clear();
+
+  u32 frames() const { return count; }
+  size_t memoryUsed() const;
+
+private:
+  static constexpr u32 KEYFRAME_INTERVAL = 60;
+
+  struct Entry {
+    size_t offset = 0;
+    u32 size = 0;
+    bool keyframe = false;
+  };
+
+  size_t stateSize;
+  size_t arenaSize;
+  std::unique_ptr<u8[]> arena; // not zeroed, pages only get touched as used
+  size_t writePos = 0;
+
+  std::vector<Entry> entries; // ring, oldest at 'first'
+  u32 first = 0;
+  u32 count = 0;
+  u32 sinceKeyframe = 0;
+
+  std::vector<u8> current;  // raw state being captured / restored
+  std::vector<u8> reference; // raw keyframe the deltas are against
+  std::vector<u8> scratch;   // encoded output before it goes in the arena
+  bool hasReference = false;
+  u64 referenceEntry = 0; // absolute index of the keyframe in reference
+  u64 pushed = 0;         // absolute index of the next entry
+
+  bool referenceLive() const {
+    return hasReference && referenceEntry >= pushed - count;
+  }
+
+  Entry &at(u32 i) { return entries[(first + i) % entries.size()]; }
+  void evictOldest();
+  u8 *reserve(size_t size);
+  size_t encode(const u8 *state, const u8 *ref);
+  void decode(const Entry &entry, const u8 *ref, u8 *out) const;
+};
+
+} // namespace jester
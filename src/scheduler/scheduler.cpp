@@ -0,0 +1,74 @@
+#include "scheduler/scheduler.hpp"
+#include "state/state.hpp"
+
+namespace jester {
+
+Scheduler::Scheduler() { reset(); }
+
+void Scheduler::reset() {
+  for (Slot &slot : slots) {
+    slot.when = NEVER;
+  }
+  currentCycle = 0;
+  next = NEVER;
+}
+
+void Scheduler::setHandler(Event ev, Callback callback, void *ctx) {
+  slots[index(ev)].callback = callback;
+  slots[index(ev)].ctx = ctx;
+}
+
+void Scheduler::schedule(Event ev, u64 when) {
+  slots[index(ev)].when = when;
+  updateNext();
+}
+
+void Scheduler::cancel(Event ev) {
+  slots[index(ev)].when = NEVER;
+  updateNext();
+}
+
+void Scheduler::updateNext() {
+  next = NEVER;
+  for (const Slot &slot : slots) {
+    if (slot.when < next)
+      next = slot.when;
+  }
+}
+
+void Scheduler::dispatch() {
+  // handlers can reschedule themselves (or others) so keep going until
+  // nothing left is due
+  while (next <= currentCycle) {
+    Slot *due = nullptr;
+    for (Slot &slot : slots) {
+      if (slot.when <= currentCycle && (!due || slot.when < due->when))
+        due = &slot;
+    }
+
+    u64 when = due->when;
+    due->when = NEVER;
+    updateNext();
+
+    if (due->callback)
+      due->callback(due->ctx, when);
+  }
+}
+
+// only the clock and the deadlines, callbacks are wiring not state
+void Scheduler::serialize(Writer &w) const {
+  w.write64(currentCycle);
+  for (const Slot &slot : slots) {
+    w.write64(slot.when);
+  }
+}
+
+void Scheduler::deserialize(Reader &r) {
+  currentCycle = r.read64();
+  for (Slot &slot : slots) {
+    slot.when = r.read64();
+  }
+  updateNext();
+}
+
+} // namespace jester
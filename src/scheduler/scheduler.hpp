@@ -0,0 +1,61 @@
+#pragma once
+
+#include "types.hpp"
+#include <array>
+
+namespace jester {
+
+class Reader;
+class Writer;
+// everything that happens at a known cycle lives in here
+enum class Event : u8 {
+  PPU,               // next ppu mode transition
+  APUFrameSequencer, // 512hz length/envelope/sweep tick
+  Timer,             // next tima overflow
+  Count
+};
+
+// keeps the global cycle count and a deadline per event. the cpu runs flat
+// out until the earliest deadline and only then do components get touched.
+// theres only a handful of event kinds so a slot per kind beats a heap.
+class Scheduler {
+public:
+  using Callback = void (*)(void *ctx, u64 when);
+
+  static constexpr u64 NEVER = ~u64(0);
+
+  Scheduler();
+
+  void reset();
+  void setHandler(Event ev, Callback callback, void *ctx);
+  void schedule(Event ev, u64 when);
+  void cancel(Event ev);
+  u64 deadline(Event ev) const { return slots[index(ev)].when; }
+
+  u64 now() const { return currentCycle; }
+  u64 nextDeadline() const { return next; }
+  bool isDue() const { return currentCycle >= next; }
+  void advance(u32 cycles) { currentCycle += cycles; }
+
+  void dispatch(); // fire everything thats due, earliest first
+
+  // save states (see state/state.hpp)
+  void serialize(Writer &w) const;
+  void deserialize(Reader &r);
+
+private:
+  struct Slot {
+    u64 when = NEVER;
+    Callback callback = nullptr;
+    void *ctx = nullptr;
+  };
+
+  std::array<Slot, static_cast<u8>(Event::Count)> slots;
+  u64 currentCycle = 0;
+  u64 next = NEVER;
+
+  static u8 index(Event ev) { return static_cast<u8>(ev); }
+  void updateNext();
+};
+
+} // namespace jester
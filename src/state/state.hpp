@@ -0,0 +1,105 @@
+#pragma once
+
+#include "types.hpp"
+#include <cstddef>
+#include <cstring>
+
+namespace jester {
+
+// save state plumbing. everything is little endian and fixed size so a
+// state for a given rom is always the same length, and nothing here ever
+// allocates: the caller hands over the buffer
+constexpr u32 STATE_MAGIC = 0x5354534A; // "JSTS"
+constexpr u16 STATE_VERSION = 2;
+
+// writes into a caller owned buffer. with a null buffer it only counts,
+// thats how the emulator works out how big a state is
+class Writer {
+public:
+  Writer(u8 *buffer, size_t capacity) : buffer(buffer), capacity(capacity) {}
+
+  void write8(u8 v) {
+    if (buffer && pos < capacity)
+      buffer[pos] = v;
+    else if (buffer)
+      overflow = true;
+    pos++;
+  }
+  void write16(u16 v) {
+    write8(v & 0xFF);
+    write8(v >> 8);
+  }
+  void write32(u32 v) {
+    write16(v & 0xFFFF);
+    write16(v >> 16);
+  }
+  void write64(u64 v) {
+    write32(static_cast<u32>(v));
+    write32(static_cast<u32>(v >> 32));
+  }
+  void writeBool(bool v) { write8(v ? 1 : 0); }
+  void writeBytes(const u8 *data, size_t size) {
+    if (buffer && pos + size <= capacity)
+      std::memcpy(buffer + pos, data, size);
+    else if (buffer)
+      overflow = true;
+    pos += size;
+  }
+
+  size_t size() const { return pos; }
+  bool ok() const { return !overflow; }
+
+private:
+  u8 *buffer;
+  size_t capacity;
+  size_t pos = 0;
+  bool overflow = false;
+};
+
+// reads back what Writer made. running off the end gives zeros and
+// flips ok() so the caller can bail
+class Reader {
+public:
+  Reader(const u8 *data, size_t size) : data(data), length(size) {}
+
+  u8 read8() {
+    if (pos >= length) {
+      underflow = true;
+      return 0;
+    }
+    return data[pos++];
+  }
+  u16 read16() {
+    u16 lo = read8();
+    return lo | (static_cast<u16>(read8()) << 8);
+  }
+  u32 read32() {
+    u32 lo = read16();
+    return lo | (static_cast<u32>(read16()) << 16);
+  }
+  u64 read64() {
+    u64 lo = read32();
+    return lo | (static_cast<u64>(read32()) << 32);
+  }
+  bool readBool() { return read8() != 0; }
+  void readBytes(u8 *out, size_t size) {
+    if (pos + size > length) {
+      underflow = true;
+      std::memset(out, 0, size);
+      return;
+    }
+    std::memcpy(out, data + pos, size);
+    pos += size;
+  }
+
+  size_t position() const { return pos; }
+  bool ok() const { return !underflow; }
+
+private:
+  const u8 *data;
+  size_t length;
+  size_t pos = 0;
+  bool underflow = false;
+};
+
+} // namespace jester
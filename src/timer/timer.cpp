@@ -0,0 +1,148 @@
+#include "timer/timer.hpp"
+#include "bus/bus.hpp"
+#include "scheduler/scheduler.hpp"
+#include "state/state.hpp"
+
+namespace jester {
+
+Timer::Timer() { reset(); }
+
+void Timer::reset() {
+  // post-boot dmg state: div already counted up to 0xAB
+  divEpoch = now() - 0xAB00;
+  lastSync = now();
+  tima = 0x00;
+  tma = 0x00;
+  tac = 0x00;
+  scheduleOverflow();
+}
+
+void Timer::attachScheduler(Scheduler *sched) {
+  scheduler = sched;
+  if (scheduler) {
+    scheduler->setHandler(Event::Timer, &Timer::onOverflow, this);
+  }
+  reset();
+}
+
+u64 Timer::now() const { return scheduler ? scheduler->now() : 0; }
+
+u8 Timer::timaShift() const {
+  // 4096hz, 262144hz, 65536hz, 16384hz in cpu clocks
+  static constexpr u8 SHIFTS[4] = {10, 4, 6, 8};
+  return SHIFTS[tac & 0x03];
+}
+
+void Timer::onOverflow(void *ctx, u64 when) {
+  (void)when;
+  auto timer = static_cast<Timer *>(ctx);
+  timer->sync();
+  timer->scheduleOverflow();
+}
+
+void Timer::sync() {
+  u64 current = now();
+  if (enabled()) {
+    u8 shift = timaShift();
+    addTicks((divider(current) >> shift) - (divider(lastSync) >> shift));
+  }
+  lastSync = current;
+}
+
+void Timer::addTicks(u64 ticks) {
+  while (ticks > 0) {
+    u64 room = 0x100 - tima;
+    if (ticks < room) {
+      tima += static_cast<u8>(ticks);
+      return;
+    }
+    // overflow: reload from tma and yell at the cpu
+    ticks -= room;
+    tima = tma;
+    if (bus)
+      bus->requestInterrupt(INT_TIMER);
+  }
+}
+
+void Timer::scheduleOverflow() {
+  if (!scheduler)
+    return;
+  if (!enabled()) {
+    scheduler->cancel(Event::Timer);
+    return;
+  }
+
+  // jump straight to the divider edge that pushes tima past 0xFF
+  u8 shift = timaShift();
+  u64 edge = (divider(now()) >> shift) + (0x100 - tima);
+  scheduler->schedule(Event::Timer, divEpoch + (edge << shift));
+}
+
+u8 Timer::readRegister(u16 addr) {
+  switch (addr) {
+  case 0xFF04:
+    return static_cast<u8>(divider(now()) >> 8); // DIV
+  case 0xFF05:
+    sync();
+    return tima; // TIMA
+  case 0xFF06:
+    return tma; // TMA
+  case 0xFF07:
+    return tac | 0xF8; // TAC
+  default:
+    return 0xFF;
+  }
+}
+
+void Timer::writeRegister(u16 addr, u8 val) {
+  sync();
+  u64 current = now();
+
+  switch (addr) {
+  case 0xFF04: {
+    // div: any write resets it back to zero lol. if the bit tima watches
+    // was high that counts as a falling edge
+    if (enabled() && ((divider(current) >> (timaShift() - 1)) & 1))
+      addTicks(1);
+    divEpoch = current;
+    break;
+  }
+  case 0xFF05:
+    tima = val;
+    break;
+  case 0xFF06:
+    tma = val;
+    break;
+  case 0xFF07: {
+    // switching off or changing speed can drop the watched bit too
+    bool oldBit =
+        enabled() && ((divider(current) >> (timaShift() - 1)) & 1);
+    tac = val & 0x07;
+    bool newBit =
+        enabled() && ((divider(current) >> (timaShift() - 1)) & 1);
+    if (oldBit && !newBit)
+      addTicks(1);
+    break;
+  }
+  }
+
+  scheduleOverflow();
+}
+
+void Timer::serialize(Writer &w) const {
+  w.write64(divEpoch);
+  w.write64(lastSync);
+  w.write8(tima);
+  w.write8(tma);
+  w.write8(tac);
+}
+
+void Timer::deserialize(Reader &r) {
+  divEpoch = r.read64();
+  lastSync = r.read64();
+  tima = r.read8();
+  tma = r.read8();
+  tac = r.read8();
+}
+
+} // namespace jester
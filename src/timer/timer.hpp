@@ -0,0 +1,49 @@
+#pragma once
+
+#include "types.hpp"
+
+namespace jester {
+
+class Bus;
+class Reader;
+class Scheduler;
+class Writer;
+
+// div/tima/tma/tac. nothing ticks per cycle: div and tima are worked out
+// from the scheduler clock when someone reads them, and the only event is
+// the next tima overflow
+class Timer {
+public:
+  Timer();
+
+  void reset();
+  void attachBus(Bus *b) { bus = b; }
+  void attachScheduler(Scheduler *sched);
+
+  u8 readRegister(u16 addr);
+  void writeRegister(u16 addr, u8 val);
+
+  // save states (see state/state.hpp)
+  void serialize(Writer &w) const;
+  void deserialize(Reader &r);
+
+private:
+  Bus *bus = nullptr;
+  Scheduler *scheduler = nullptr;
+
+  u64 divEpoch = 0; // cycle the internal 16-bit divider was last zero
+  u64 lastSync = 0; // tima is up to date as of this cycle
+  u8 tima = 0, tma = 0, tac = 0;
+
+  u64 now() const;
+  u64 divider(u64 cycle) const { return cycle - divEpoch; }
+  bool enabled() const { return (tac & 0x04) != 0; }
+  u8 timaShift() const; // tima ticks when this divider bit falls
+
+  static void onOverflow(void *ctx, u64 when);
+  void sync();
+  void addTicks(u64 ticks);
+  void scheduleOverflow();
+};
+
+} // namespace jester
@@ -0,0 +1,67 @@
+#include "tui/output_thread.hpp"
+#include "tui/renderer.hpp"
+#include <chrono>
+
+namespace jester {
+
+OutputThread::OutputThread(Renderer &r)
+    : renderer(r), thread(&OutputThread::run, this) {}
+
+OutputThread::~OutputThread() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+  }
+  wake.notify_one();
+  thread.join();
+}
+
+// no lock here on purpose, the emulation thread must never wait on us.
+// a wakeup that slips past the check in run() gets caught by its timeout
+void OutputThread::submit() {
+  if (!frames.publish())
+    dropped++;
+  wake.notify_one();
+}
+
+void OutputThread::pause() {
+  std::unique_lock<std::mutex> lock(mutex);
+  paused = true;
+  idle.wait(lock, [this] { return !busy; });
+}
+
+void OutputThread::resume() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    paused = false;
+  }
+  wake.notify_one();
+}
+
+void OutputThread::run() {
+  std::unique_lock<std::mutex> lock(mutex);
+  while (!stopping) {
+    if (paused || !frames.update()) {
+      // a frame is ~16ms, waking up a few times per frame to look is free
+      wake.wait_for(lock, std::chrono::milliseconds(4));
+      continue;
+    }
+
+    // terminal writes happen without the lock, pause() just waits them out
+    busy = true;
+    lock.unlock();
+
+    const OutputFrame &frame = frames.front();
+    renderer.render(frame.pixels);
+    if (frame.debug) {
+      renderer.renderDebug(frame.pc, frame.a, frame.f, frame.sp, frame.fps,
+                           frame.cycles);
+    }
+
+    lock.lock();
+    busy = false;
+    idle.notify_all();
+  }
+}
+
+} // namespace jester
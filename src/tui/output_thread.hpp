@@ -0,0 +1,64 @@
+#pragma once
+
+#include "tui/triple_buffer.hpp"
+#include "types.hpp"
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+namespace jester {
+
+class Renderer;
+
+// everything the output side needs to draw one frame
+struct OutputFrame {
+  std::array<u8, 160 * 144> pixels;
+  bool debug = false;
+  u16 pc = 0, sp = 0;
+  u8 a = 0, f = 0;
+  double fps = 0.0;
+  u64 cycles = 0;
+};
+
+// draws frames and pushes them to the terminal on its own thread, so a slow
+// terminal (or ssh link) never holds up emulation or audio. the emulation
+// side fills frame() and calls submit(), which never blocks. if the
+// terminal cant keep up, frames in between just get skipped
+class OutputThread {
+public:
+  explicit OutputThread(Renderer &renderer);
+  ~OutputThread();
+
+  OutputThread(const OutputThread &) = delete;
+  OutputThread &operator=(const OutputThread &) = delete;
+
+  OutputFrame &frame() { return frames.back(); }
+  void submit();
+
+  // hand the terminal back to the caller (menus etc). pause waits for the
+  // frame being drawn to finish, so dont call it from anything hot
+  void pause();
+  void resume();
+
+  u64 getDroppedFrames() const { return dropped.load(); }
+
+private:
+  Renderer &renderer;
+  TripleBuffer<OutputFrame> frames;
+  std::atomic<u64> dropped{0};
+
+  std::mutex mutex;
+  std::condition_variable wake;
+  bool stopping = false;
+  bool paused = false;
+  bool busy = false; // drawing right now
+  std::condition_variable idle;
+
+  std::thread thread;
+
+  void run();
+};
+
+} // namespace jester
@@ -3,75 +3,167 @@
 
 namespace jester {
 
-Renderer::Renderer() { brailleBuffer.fill(0); }
+Renderer::Renderer() {
+  cells.fill(0);
+  shown.fill(0);
+  // pack all this shit into one string cuz syscalls are expensive af. its
+  // big enough for a full repaint so render never has to grow it
+  frame.reserve(TERM_WIDTH * TERM_HEIGHT * 8);
+}
 
-void Renderer::init(Terminal *term) { terminal = term; }
+void Renderer::init(Terminal *term) {
+  terminal = term;
+  repaint = true;
+}
 
 void Renderer::render(
     const std::array<u8, SCREEN_WIDTH * SCREEN_HEIGHT> &frameBuffer) {
   if (!terminal)
     return;
 
-  // pack all this shit into one string cuz syscalls are expensive af
-  std::string frame;
-  frame.reserve(TERM_WIDTH * TERM_HEIGHT * 8); // pre-allocate memory mfs
-
-  // pick a color and stick with it zoomers (speed hacks)
-  frame += getColorCode(0); // Use brightest color always
+  // new size = terminal probably reflowed or wiped everything. the wipe
+  // and redraw go into the same synchronized update as the frame
+  if (terminal->consumeResize()) {
+    terminal->beginFrame();
+    terminal->clearScreen();
+    drawBorder();
+  }
 
   // Process the frame buffer in 2x4 blocks
   for (u16 by = 0; by < TERM_HEIGHT; by++) {
-    // teleport the cursor to the right spot for this row
-    char buf[16];
-    snprintf(buf, sizeof(buf), "\033[%d;%dH", BORDER_Y + by + 1, BORDER_X + 1);
-    frame += buf;
+    renderRow(frameBuffer, by, &cells[by * TERM_WIDTH]);
+  }
+
+  frame.clear(); // keeps the capacity
 
+  // only the cells that changed go out. the cursor is wherever the debug
+  // line or a menu left it, so the first jump is always absolute
+  u16 curX = NO_CURSOR, curY = NO_CURSOR;
+  bool colored = false;
+  for (u16 by = 0; by < TERM_HEIGHT; by++) {
     for (u16 bx = 0; bx < TERM_WIDTH; bx++) {
-      frame += renderBlock(frameBuffer, bx, by);
+      u16 i = by * TERM_WIDTH + bx;
+      if (!repaint && cells[i] == shown[i])
+        continue;
+
+      // pick a color and stick with it zoomers (speed hacks)
+      if (!colored) {
+        frame += getColorCode(); // Use brightest color always
+        colored = true;
+      }
+      moveCursor(frame, curX, curY, bx, by);
+      appendCell(frame, cells[i]);
+      shown[i] = cells[i];
+      curX++;
     }
   }
+  repaint = false;
 
-  terminal->write(frame);
-  terminal->flush();
+  if (frame.empty())
+    return;
+  terminal->beginFrame();
+  terminal->present(frame);
 }
 
-std::string
-Renderer::renderBlock(const std::array<u8, SCREEN_WIDTH * SCREEN_HEIGHT> &fb,
-                      u16 blockX, u16 blockY) {
-  u16 px = blockX * 2;
-  u16 py = blockY * 4;
+static u16 digits(u16 n) { return n >= 100 ? 3 : n >= 10 ? 2 : 1; }
 
-  bool dots[8];
-  bool hasContent = false;
+// how many bytes an escape with one number in it takes ("\033[12C" = 5),
+// with the number left out when its 1 since thats the default
+static u16 escapeLength(u16 n) { return n == 1 ? 3 : 3 + digits(n); }
 
-  for (u8 row = 0; row < 4; row++) {
-    for (u8 col = 0; col < 2; col++) {
-      u16 x = px + col;
-      u16 y = py + row;
+static void appendEscape(std::string &out, u16 n, char command) {
+  char buf[16];
+  if (n == 1)
+    snprintf(buf, sizeof(buf), "\033[%c", command);
+  else
+    snprintf(buf, sizeof(buf), "\033[%d%c", n, command);
+  out += buf;
+}
 
-      u8 color = 0;
-      if (x < SCREEN_WIDTH && y < SCREEN_HEIGHT) {
-        color = fb[y * SCREEN_WIDTH + x];
+// get the cursor from (curX, curY) to cell (x, y) in as few bytes as we
+// can: an absolute jump, relative up/down + left/right/column, or just
+// writing the unchanged cells in between again when thats shorter
+void Renderer::moveCursor(std::string &out, u16 &curX, u16 &curY, u16 x,
+                          u16 y) {
+  if (curX == x && curY == y)
+    return;
+
+  u16 row = BORDER_Y + y + 1;
+  u16 col = BORDER_X + x + 1;
+  u16 absolute = 4 + digits(row) + digits(col); // "\033[row;colH"
+
+  if (curY != NO_CURSOR) {
+    u16 dy = curY < y ? y - curY : curY - y;
+    u16 dx = curX < x ? x - curX : curX - x;
+    bool column = dx && escapeLength(col) < escapeLength(dx); // CHA
+    u16 vertical = dy ? escapeLength(dy) : 0;
+    u16 horizontal = !dx ? 0 : column ? escapeLength(col) : escapeLength(dx);
+
+    if (!dy && curX < x) {
+      u16 rewrite = 0;
+      for (u16 i = curX; i < x; i++)
+        rewrite += cellBytes(shown[y * TERM_WIDTH + i]);
+      if (rewrite <= horizontal) {
+        for (u16 i = curX; i < x; i++)
+          appendCell(out, shown[y * TERM_WIDTH + i]);
+        curX = x;
+        return;
       }
+    }
 
-      // if the pixel is bright, give it a dot lol
-      bool isLit = (color <= 1);
-      dots[row + col * 4] = isLit;
-      if (isLit)
-        hasContent = true;
+    if (vertical + horizontal < absolute) {
+      if (dy)
+        appendEscape(out, dy, curY < y ? 'B' : 'A');
+      if (column)
+        appendEscape(out, col, 'G');
+      else if (dx)
+        appendEscape(out, dx, curX < x ? 'C' : 'D');
+      curX = x;
+      curY = y;
+      return;
     }
   }
 
-  if (!hasContent) {
-    return " ";
-  }
+  char buf[24];
+  snprintf(buf, sizeof(buf), "\033[%d;%dH", row, col);
+  out += buf;
+  curX = x;
+  curY = y;
+}
 
-  return Terminal::brailleToUTF8(Terminal::pixelsToBraille(dots));
+void Renderer::appendCell(std::string &out, u8 mask) {
+  if (!mask) {
+    out += ' ';
+    return;
+  }
+  out.append(BRAILLE_UTF8[mask].data(), 3);
 }
 
-std::string Renderer::getColorCode(u8 gbColor) {
-  (void)gbColor; // ignore this for now, single color is faster anyway
+// one row of cells = 4 scanlines. each cell is 2x4 pixels, bright ones
+// (shade 0/1) get a dot, packed straight into the braille bit layout
+void Renderer::renderRow(
+    const std::array<u8, SCREEN_WIDTH * SCREEN_HEIGHT> &fb, u16 blockY,
+    u8 *out) {
+  static_assert(TERM_WIDTH * 2 == SCREEN_WIDTH &&
+                    TERM_HEIGHT * 4 == SCREEN_HEIGHT,
+                "cells have to tile the screen exactly");
+
+  const u8 *r0 = &fb[blockY * 4 * SCREEN_WIDTH];
+  const u8 *r1 = r0 + SCREEN_WIDTH;
+  const u8 *r2 = r1 + SCREEN_WIDTH;
+  const u8 *r3 = r2 + SCREEN_WIDTH;
+  auto lit = [](u8 shade) { return static_cast<u8>(shade <= 1); };
+
+  for (u16 bx = 0; bx < TERM_WIDTH; bx++) {
+    u16 l = bx * 2, r = l + 1;
+    out[bx] = lit(r0[l]) | lit(r1[l]) << 1 | lit(r2[l]) << 2 |
+              lit(r0[r]) << 3 | lit(r1[r]) << 4 | lit(r2[r]) << 5 |
+              lit(r3[l]) << 6 | lit(r3[r]) << 7;
+  }
+}
 
+// single color for the whole screen, its faster anyway
+const char *Renderer::getColorCode() const {
   switch (colorPalette) {
   case 0: // Pure white
     return "\033[38;2;255;255;255m";
@@ -132,6 +224,9 @@ void Renderer::drawBorder() {
   border += "\033[0m";
   terminal->write(border);
   terminal->flush();
+
+  // whoever called this just cleared the screen or drew a menu over it
+  repaint = true;
 }
 
 void Renderer::renderDebug(u16 pc, u8 a, u8 f, u16 sp, double fps, u64 cycles) {
@@ -143,16 +238,20 @@ void Renderer::renderDebug(u16 pc, u8 a, u8 f, u16 sp, double fps, u64 cycles) {
 
   snprintf(buf, sizeof(buf),
            "\033[%d;%dH\033[38;2;100;100;100mFPS:%.0f PC:%04X SP:%04X A:%02X "
-           "[%c%c%c%c]",
+           "[%c%c%c%c] OUT:%.1fKB/s\033[K",
            debugY, BORDER_X + 1, fps, pc, sp, a, (f & 0x80) ? 'Z' : '-',
            (f & 0x40) ? 'N' : '-', (f & 0x20) ? 'H' : '-',
-           (f & 0x10) ? 'C' : '-');
+           (f & 0x10) ? 'C' : '-', terminal->getBytesPerSecond() / 1024.0);
 
   terminal->write(buf);
+  terminal->flush();
 
   (void)cycles; // dont show this, too much clutter on screen lol
 }
 
-void Renderer::setPalette(u8 palette) { colorPalette = palette; }
+void Renderer::setPalette(u8 palette) {
+  colorPalette = palette;
+  repaint = true;
+}
 
 } // namespace jester
@@ -13,8 +13,11 @@ public:
 
   void init(Terminal *term);
   void setPalette(u8 pal);
+  // only sends the cells that changed since the last call, unless
+  // something (palette, border, resize) forced a full repaint
   void render(const std::array<u8, 160 * 144> &frameBuffer);
   void drawBorder();
+  void invalidate() { repaint = true; } // screen got trashed behind our back
   void renderDebug(u16 pc, u8 a, u8 f, u16 sp, double fps, u64 cycles);
 
 private:
@@ -34,9 +37,19 @@ private:
       {{155, 188, 255}, {100, 140, 200}, {50, 90, 150}, {20, 40, 80}},
       {{255, 155, 200}, {220, 100, 160}, {160, 60, 120}, {80, 20, 60}}};
 
-  std::array<u32, 80 * 36> brailleBuffer;
-  std::string getColorCode(u8 gbColor);
-  std::string renderBlock(const std::array<u8, 160 * 144> &fb, u16 bx, u16 by);
+  // braille dot mask per cell, 0 = blank. shown is what the terminal has
+  std::array<u8, 80 * 36> cells;
+  std::array<u8, 80 * 36> shown;
+  bool repaint = true;
+  static constexpr u16 NO_CURSOR = 0xFFFF;
+
+  std::string frame; // reused every render, no allocations per frame
+
+  const char *getColorCode() const;
+  void renderRow(const std::array<u8, 160 * 144> &fb, u16 by, u8 *out);
+  static void appendCell(std::string &out, u8 mask);
+  static u16 cellBytes(u8 mask) { return mask ? 3 : 1; }
+  void moveCursor(std::string &out, u16 &curX, u16 &curY, u16 x, u16 y);
 };
 
 } // namespace jester
@@ -1,13 +1,88 @@
 #include "tui/terminal.hpp"
+#include <csignal>
 #include <cstdio>
 
 #ifdef _WIN32
 #include <windows.h>
+#else
+#include <cerrno>
+#include <poll.h>
+#include <sys/uio.h>
+#include <termios.h>
+#include <unistd.h>
 #endif
 
 namespace jester {
 
-Terminal::Terminal() = default;
+static volatile std::sig_atomic_t resized = 0;
+
+#ifndef _WIN32
+static void onResize(int) { resized = 1; }
+#endif
+
+static constexpr std::string_view BEGIN_SYNC = "\033[?2026h";
+static constexpr std::string_view END_SYNC = "\033[?2026l";
+
+#ifndef _WIN32
+// ask the terminal if it knows mode 2026 (DECRQM), with a DA1 request right
+// behind it. everything answers DA1, so if that comes back first (or
+// nothing does before the timeout) theres no sync support and we dont hang
+// around waiting. the reply is "\033[?2026;N$y", N=1/2 means set/reset aka
+// supported, 0 or 4 means no
+static bool probeSyncUpdate() {
+  if (!isatty(STDIN_FILENO) || !isatty(STDOUT_FILENO))
+    return false;
+
+  termios saved;
+  if (tcgetattr(STDIN_FILENO, &saved) != 0)
+    return false;
+  termios raw = saved;
+  raw.c_lflag &= ~(ICANON | ECHO); // replies must not end up on screen
+  raw.c_cc[VMIN] = 0;
+  raw.c_cc[VTIME] = 0;
+  tcsetattr(STDIN_FILENO, TCSANOW, &raw);
+
+  static const char query[] = "\033[?2026$p\033[c";
+  fflush(stdout);
+  bool sent = ::write(STDOUT_FILENO, query, sizeof(query) - 1) ==
+              static_cast<ssize_t>(sizeof(query) - 1);
+
+  std::string reply;
+  int mode = -1;
+  auto deadline =
+      std::chrono::steady_clock::now() + std::chrono::milliseconds(200);
+  while (sent) {
+    auto left = std::chrono::duration_cast<std::chrono::milliseconds>(
+                    deadline - std::chrono::steady_clock::now())
+                    .count();
+    pollfd in = {STDIN_FILENO, POLLIN, 0};
+    if (left <= 0 || poll(&in, 1, static_cast<int>(left)) <= 0)
+      break;
+    char buf[64];
+    ssize_t n = ::read(STDIN_FILENO, buf, sizeof(buf));
+    if (n <= 0)
+      break;
+    reply.append(buf, n);
+
+    size_t at = reply.find("\033[?2026;");
+    if (at != std::string::npos && reply.find("$y", at) != std::string::npos)
+      mode = reply[at + 8] - '0';
+    // DA1 reply ends with 'c', and its always the last thing we get
+    size_t da = reply.find("\033[?", at == std::string::npos ? 0 : at + 1);
+    if (da != std::string::npos && reply.find('c', da) != std::string::npos)
+      break;
+  }
+
+  tcsetattr(STDIN_FILENO, TCSANOW, &saved);
+  return mode == 1 || mode == 2;
+}
+#endif
+
+Terminal::Terminal() {
+  // a full repaint is ~10k, escapes and debug line go on top of that
+  pending.reserve(16 * 1024);
+  windowStart = std::chrono::steady_clock::now();
+}
 Terminal::~Terminal() { cleanup(); }
 
 void Terminal::init() {
@@ -20,78 +95,132 @@ void Terminal::init() {
   GetConsoleMode(hOut, &dwMode);
   dwMode |= ENABLE_VIRTUAL_TERMINAL_PROCESSING;
   SetConsoleMode(hOut, dwMode);
+#else
+  signal(SIGWINCH, onResize);
+  syncUpdate = probeSyncUpdate();
 #endif
-  printf("\033[?25l");
-  printf("\033[2J");
-  fflush(stdout);
+  write("\033[?25l\033[2J", 10);
+  flush();
 }
 
 void Terminal::cleanup() {
-  printf("\033[?25h");
-  printf("\033[0m");
-  printf("\033[2J\033[H");
-  fflush(stdout);
+  static const char reset[] = "\033[?25h\033[0m\033[2J\033[H";
+  write(reset, sizeof(reset) - 1);
+  flush();
 }
 
 void Terminal::clearScreen() {
-  printf("\033[2J\033[H");
-  fflush(stdout);
+  write("\033[2J\033[H", 7);
+  flush();
 }
 
-void Terminal::moveCursor(u16 x, u16 y) { printf("\033[%d;%dH", y, x); }
-void Terminal::hideCursor() { printf("\033[?25l"); }
-void Terminal::showCursor() { printf("\033[?25h"); }
+void Terminal::moveCursor(u16 x, u16 y) {
+  char buf[24];
+  int n = snprintf(buf, sizeof(buf), "\033[%d;%dH", y, x);
+  write(buf, n);
+}
+void Terminal::hideCursor() { write("\033[?25l", 6); }
+void Terminal::showCursor() { write("\033[?25h", 6); }
 void Terminal::setColor(u8 r, u8 g, u8 b) {
-  printf("\033[38;2;%d;%d;%dm", r, g, b);
+  char buf[32];
+  int n = snprintf(buf, sizeof(buf), "\033[38;2;%d;%d;%dm", r, g, b);
+  write(buf, n);
 }
-void Terminal::resetColor() { printf("\033[0m"); }
-void Terminal::write(const std::string &text) { printf("%s", text.c_str()); }
-void Terminal::flush() { fflush(stdout); }
-
-u32 Terminal::pixelsToBraille(bool dots[8]) { return brailleCodepoint(dots); }
-
-u32 Terminal::brailleCodepoint(bool dots[8]) {
-  u32 cp = 0x2800; // braille base offset mfs
-  if (dots[0])
-    cp |= 0x01;
-  if (dots[1])
-    cp |= 0x02;
-  if (dots[2])
-    cp |= 0x04;
-  if (dots[3])
-    cp |= 0x40;
-  if (dots[4])
-    cp |= 0x08;
-  if (dots[5])
-    cp |= 0x10;
-  if (dots[6])
-    cp |= 0x20;
-  if (dots[7])
-    cp |= 0x80;
-  return cp;
+void Terminal::resetColor() { write("\033[0m", 4); }
+
+void Terminal::write(const char *data, size_t size) {
+  pending.append(data, size);
+}
+
+void Terminal::flush() {
+  fflush(stdout); // menus still printf, they have to land before we do
+  std::string_view chunk = pending;
+  send(&chunk, 1);
+  pending.clear();
+}
+
+void Terminal::beginFrame() {
+  if (!syncUpdate || inFrame)
+    return;
+  write(BEGIN_SYNC.data(), BEGIN_SYNC.size());
+  inFrame = true;
 }
 
-// convert that braille codepoint to utf8 so we can actually print it
-std::string Terminal::brailleToUTF8(u32 cp) {
-  char buf[5];
-  if (cp < 0x80) {
-    buf[0] = cp;
-    buf[1] = 0;
-  } else if (cp < 0x800) {
-    buf[0] = 0xC0 | (cp >> 6);
-    buf[1] = 0x80 | (cp & 0x3F);
-    buf[2] = 0;
-  } else {
-    buf[0] = 0xE0 | (cp >> 12);
-    buf[1] = 0x80 | ((cp >> 6) & 0x3F);
-    buf[2] = 0x80 | (cp & 0x3F);
-    buf[3] = 0;
+void Terminal::present(const std::string &frame) {
+  fflush(stdout);
+  std::string_view chunks[3] = {pending, frame,
+                                inFrame ? END_SYNC : std::string_view()};
+  send(chunks, 3);
+  pending.clear();
+  inFrame = false;
+}
+
+// push the chunks out in as few syscalls as the kernel lets us. a full
+// pty/socket buffer (ssh, slow terminal, nonblocking stdout) gives partial
+// writes or EAGAIN, so keep going from wherever it stopped
+void Terminal::send(const std::string_view *chunks, int count) {
+#ifdef _WIN32
+  for (int i = 0; i < count; i++) {
+    fwrite(chunks[i].data(), 1, chunks[i].size(), stdout);
+    countBytes(chunks[i].size());
+  }
+  fflush(stdout);
+#else
+  iovec vecs[4];
+  int used = 0;
+  for (int i = 0; i < count && used < 4; i++) {
+    if (chunks[i].empty())
+      continue;
+    vecs[used++] = {const_cast<char *>(chunks[i].data()), chunks[i].size()};
+  }
+
+  iovec *iov = vecs;
+  while (used) {
+    ssize_t n = ::writev(STDOUT_FILENO, iov, used);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        pollfd out = {STDOUT_FILENO, POLLOUT, 0};
+        poll(&out, 1, 100);
+        continue;
+      }
+      return; // terminal went away, nothing useful left to do with it
+    }
+    countBytes(n);
+
+    size_t written = n;
+    while (used && written >= iov->iov_len) {
+      written -= iov->iov_len;
+      iov++;
+      used--;
+    }
+    if (used) {
+      iov->iov_base = static_cast<char *>(iov->iov_base) + written;
+      iov->iov_len -= written;
+    }
+  }
+#endif
+}
+
+void Terminal::countBytes(size_t n) {
+  bytesWritten += n;
+  windowBytes += n;
+
+  auto now = std::chrono::steady_clock::now();
+  double elapsed = std::chrono::duration<double>(now - windowStart).count();
+  if (elapsed >= 1.0) {
+    bytesPerSecond = static_cast<u32>(windowBytes / elapsed);
+    windowBytes = 0;
+    windowStart = now;
   }
-  return std::string(buf);
 }
 
-std::string Terminal::toBraille(bool dots[8]) {
-  return brailleToUTF8(brailleCodepoint(dots));
+bool Terminal::consumeResize() {
+  if (!resized)
+    return false;
+  resized = 0;
+  return true;
 }
 
 } // namespace jester
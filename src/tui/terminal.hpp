@@ -1,10 +1,31 @@
 #pragma once
 
 #include "types.hpp"
+#include <array>
+#include <chrono>
+#include <cstddef>
 #include <string>
+#include <string_view>
 
 namespace jester {
 
+// utf-8 for every braille cell U+2800 + mask, all 3 bytes long.
+// mask bits are the unicode dot numbers: 0x01 0x08 / 0x02 0x10 /
+// 0x04 0x20 / 0x40 0x80, left column first
+using BrailleGlyph = std::array<char, 3>;
+constexpr std::array<BrailleGlyph, 256> makeBrailleTable() {
+  std::array<BrailleGlyph, 256> table{};
+  for (u32 mask = 0; mask < 256; mask++) {
+    u32 cp = 0x2800 + mask;
+    table[mask] = {static_cast<char>(0xE0 | (cp >> 12)),
+                   static_cast<char>(0x80 | ((cp >> 6) & 0x3F)),
+                   static_cast<char>(0x80 | (cp & 0x3F))};
+  }
+  return table;
+}
+inline constexpr std::array<BrailleGlyph, 256> BRAILLE_UTF8 =
+    makeBrailleTable();
+
 class Terminal {
 public:
   Terminal();
@@ -19,13 +40,37 @@ public:
   void showCursor();
   void setColor(u8 r, u8 g, u8 b);
   void resetColor();
-  void write(const std::string &text);
+  // everything gets queued in one reused buffer and goes out in a single
+  // write(2) on flush. stdio gets flushed first so printf'd menus stay in
+  // order with us
+  void write(const std::string &text) { write(text.data(), text.size()); }
+  void write(const char *data, size_t size);
   void flush();
+  void present(const std::string &frame); // flush + frame, one writev
+
+  // on terminals with synchronized output (dec mode 2026) everything from
+  // beginFrame() to present() shows up at once instead of tearing halfway
+  // through. does nothing elsewhere. support gets probed once in init()
+  void beginFrame();
+  bool hasSyncUpdate() const { return syncUpdate; }
+
+  u64 getBytesWritten() const { return bytesWritten; }
+  u32 getBytesPerSecond() const { return bytesPerSecond; }
+
+  // true once after the window changed size (sigwinch, posix only)
+  bool consumeResize();
+
+private:
+  std::string pending;
+  u64 bytesWritten = 0;
+  u64 windowBytes = 0; // since windowStart, for the per second number
+  u32 bytesPerSecond = 0;
+  std::chrono::steady_clock::time_point windowStart;
+  bool syncUpdate = false;
+  bool inFrame = false; // sent the begin marker, end goes out with present
 
-  static u32 pixelsToBraille(bool dots[8]);
-  static std::string brailleToUTF8(u32 codepoint);
-  static std::string toBraille(bool dots[8]);
-  static u32 brailleCodepoint(bool dots[8]);
+  void send(const std::string_view *chunks, int count);
+  void countBytes(size_t n);
 };
 
 } // namespace jester
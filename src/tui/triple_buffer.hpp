@@ -0,0 +1,44 @@
+#pragma once
+
+#include "types.hpp"
+#include <array>
+#include <atomic>
+
+namespace jester {
+
+// one writer, one reader, no locks and nobody ever waits on anybody.
+// the writer always has a slot to fill, the reader always has the newest
+// finished one, and the third slot sits in the middle to be swapped. if the
+// writer publishes twice before the reader looks, the older one is just
+// overwritten (dropped), which is exactly what you want for video frames
+template <typename T> class TripleBuffer {
+public:
+  // writer side
+  T &back() { return slots[backIndex]; }
+  // hand back() over, returns false if the last one was never picked up
+  bool publish() {
+    u8 old = middle.exchange(backIndex | FRESH, std::memory_order_acq_rel);
+    backIndex = old & INDEX;
+    return !(old & FRESH);
+  }
+
+  // reader side. true (and front() switched to it) if theres a newer slot
+  bool update() {
+    if (!(middle.load(std::memory_order_relaxed) & FRESH))
+      return false;
+    frontIndex = middle.exchange(frontIndex, std::memory_order_acq_rel) & INDEX;
+    return true;
+  }
+  const T &front() const { return slots[frontIndex]; }
+
+private:
+  static constexpr u8 INDEX = 0x03;
+  static constexpr u8 FRESH = 0x04; // middle holds something unread
+
+  std::array<T, 3> slots{};
+  u8 backIndex = 0;              // writer only
+  u8 frontIndex = 1;             // reader only
+  std::atomic<u8> middle{2};     // swapped between them
+};
+
+} // namespace jester
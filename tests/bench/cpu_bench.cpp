@@ -0,0 +1,52 @@
+/* cpu dispatch micro-benchmark. runs a rom (blargg's cpu_instrs is a good
+ * one, the tree only has its sources) for a fixed number of frames with no terminal or audio and prints how many
+ * instructions per second the interpreter managed. build with
+ * -DJESTER_BUILD_BENCH=ON and flip JESTER_THREADED_DISPATCH to compare. */
+
+#include "emulator/emulator.hpp"
+#include "types.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+using namespace jester;
+
+int main(int argc, char *argv[]) {
+  if (argc < 2) {
+    std::fprintf(stderr, "Usage: %s <rom.gb> [frames]\n", argv[0]);
+    return 1;
+  }
+  const char *romPath = argv[1];
+  int frames = (argc > 2) ? std::atoi(argv[2]) : 3600;
+
+  Emulator emulator;
+  if (!emulator.loadROM(romPath)) {
+    std::fprintf(stderr, "Failed to load ROM: %s\n", romPath);
+    return 1;
+  }
+
+  using Clock = std::chrono::steady_clock;
+  auto start = Clock::now();
+
+  for (int i = 0; i < frames; i++) {
+    emulator.runFrame();
+  }
+
+  double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+  double instructions =
+      static_cast<double>(emulator.getCPU().getInstructionCount());
+
+  std::printf("dispatch:      %s\n",
+#if JESTER_THREADED_DISPATCH
+              "computed goto"
+#else
+              "switch"
+#endif
+  );
+  std::printf("frames:        %d\n", frames);
+  std::printf("instructions:  %.0f\n", instructions);
+  std::printf("wall time:     %.3f s\n", seconds);
+  std::printf("MIPS:          %.2f\n", instructions / seconds / 1e6);
+  return 0;
+}
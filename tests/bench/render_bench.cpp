@@ -0,0 +1,96 @@
+/* terminal renderer micro-benchmark. pushes synthetic frames (static noise
+ * with a block sliding across it, like a sprite over a background) through
+ * the braille renderer and reports time, bytes written and heap allocations
+ * per frame,
+ * once with full repaints and once with the normal cell diffing. the
+ * terminal output itself goes to the null device, results go to stderr.
+ * build with -DJESTER_BUILD_BENCH=ON. */
+
+#include "tui/renderer.hpp"
+#include "tui/terminal.hpp"
+#include "types.hpp"
+
+#include <array>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+
+using namespace jester;
+
+// count every heap allocation in the process. render is supposed to do none
+static unsigned long allocations = 0;
+
+void *operator new(std::size_t size) {
+  allocations++;
+  if (void *p = std::malloc(size ? size : 1))
+    return p;
+  throw std::bad_alloc();
+}
+void operator delete(void *p) noexcept { std::free(p); }
+void operator delete(void *p, std::size_t) noexcept { std::free(p); }
+
+static void makeFrame(std::array<u8, 160 * 144> &fb, int frame) {
+  std::srand(1234);
+  for (u8 &pixel : fb)
+    pixel = (std::rand() % 5 == 0) ? 3 : 0;
+
+  int sx = (frame * 2) % 144, sy = 60 + (frame / 10) % 40;
+  for (int y = 0; y < 16; y++)
+    for (int x = 0; x < 16; x++)
+      fb[(sy + y) * 160 + sx + x] = 3;
+}
+
+static void run(Terminal &terminal, Renderer &renderer, int frames,
+                bool fullRepaint) {
+  std::array<u8, 160 * 144> fb;
+  unsigned long startAllocs = allocations;
+  u64 startBytes = terminal.getBytesWritten();
+  double seconds = 0.0;
+
+  using Clock = std::chrono::steady_clock;
+  for (int i = 0; i < frames; i++) {
+    makeFrame(fb, i);
+    if (fullRepaint)
+      renderer.invalidate();
+    auto start = Clock::now();
+    renderer.render(fb);
+    seconds += std::chrono::duration<double>(Clock::now() - start).count();
+  }
+
+  std::fprintf(stderr,
+               "%-14s %8.2f us/frame %8.0f bytes/frame %6.2f allocs/frame\n",
+               fullRepaint ? "full repaint:" : "diffed:",
+               seconds * 1e6 / frames,
+               static_cast<double>(terminal.getBytesWritten() - startBytes) /
+                   frames,
+               static_cast<double>(allocations - startAllocs) / frames);
+}
+
+int main(int argc, char *argv[]) {
+  int frames = (argc > 1) ? std::atoi(argv[1]) : 20000;
+
+#ifdef _WIN32
+  const char *nullDevice = "NUL";
+#else
+  const char *nullDevice = "/dev/null";
+#endif
+  if (!std::freopen(nullDevice, "w", stdout)) {
+    std::fprintf(stderr, "cant open %s\n", nullDevice);
+    return 1;
+  }
+
+  Terminal terminal;
+  Renderer renderer;
+  renderer.init(&terminal);
+
+  // first frame is always a full repaint, dont count it
+  std::array<u8, 160 * 144> fb;
+  makeFrame(fb, 0);
+  renderer.render(fb);
+
+  std::fprintf(stderr, "frames:        %d\n", frames);
+  run(terminal, renderer, frames, true);
+  run(terminal, renderer, frames, false);
+  return 0;
+}
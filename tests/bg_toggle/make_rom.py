@@ -0,0 +1,55 @@
+#!/usr/bin/env python3
+# builds bg_toggle.gb: bg + window + two sprites (one behind the bg) with a
+# bgp that maps color 0 to black, and lcdc bit 0 flipped every time ly hits
+# 72. whichever half has the bg off has to come out all shade 0 apart from
+# the sprites. see readme.txt for the hashes it should give.
+import sys
+
+rom = bytearray(0x8000)
+pc = 0x150
+
+
+def emit(*bs):
+    global pc
+    for b in bs:
+        rom[pc] = b & 0xFF
+        pc += 1
+
+
+rom[0x100:0x104] = bytes([0x00, 0xC3, 0x50, 0x01])  # nop; jp 0150
+rom[0x134:0x13D] = b'BGTOGGLE'
+rom[0x147] = 0x00  # rom only
+
+emit(0xF3, 0x31, 0xFE, 0xFF)  # di; ld sp,fffe
+emit(0xAF, 0xE0, 0x40)        # lcd off
+# tile 1 = all four colors in stripes
+emit(0x21, 0x10, 0x80, 0x06, 0x08)
+emit(0x3E, 0x55, 0x22, 0x3E, 0x33, 0x22, 0x05, 0x20, 0xF7)
+# bg map 9800: every other row tile 1, window map 9c00: all tile 1
+emit(0x21, 0x00, 0x98, 0x0E, 0x20)       # 32 rows
+emit(0x79, 0xE6, 0x01, 0x06, 0x20)       # a = row & 1, 32 columns
+emit(0x22, 0x05, 0x20, 0xFC, 0x0D, 0x20, 0xF4)
+emit(0x21, 0x00, 0x9C, 0x01, 0x00, 0x04)
+emit(0x3E, 0x01, 0x22, 0x0B, 0x78, 0xB1, 0x20, 0xF8)
+# two sprites, the second one behind the bg, rest of oam offscreen
+emit(0x21, 0x00, 0xFE)
+for b in (76, 28, 1, 0x00, 116, 58, 1, 0x80):
+    emit(0x3E, b, 0x22)
+emit(0xAF, 0x06, 0x98, 0x22, 0x05, 0x20, 0xFC)
+# palettes, window at (80, 40)
+for reg, val in ((0x47, 0x1B), (0x48, 0xE4), (0x4A, 40), (0x4B, 87)):
+    emit(0x3E, val, 0xE0, reg)
+emit(0x3E, 0xF3, 0xE0, 0x40)  # lcd, window (9c00), 8000 tiles, obj, bg
+# loop: wait for ly 72, flip lcdc bit 0, wait for ly to move on
+emit(0xF0, 0x44, 0xFE, 0x48, 0x20, 0xFA)
+emit(0xF0, 0x40, 0xEE, 0x01, 0xE0, 0x40)
+emit(0xF0, 0x44, 0xFE, 0x48, 0x28, 0xFA)
+emit(0x18, 0xEC)
+
+check = 0
+for b in rom[0x134:0x14D]:
+    check = (check - b - 1) & 0xFF
+rom[0x14D] = check
+
+with open(sys.argv[1] if len(sys.argv) > 1 else 'bg_toggle.gb', 'wb') as f:
+    f.write(rom)